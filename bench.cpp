@@ -0,0 +1,525 @@
+/*
+ *      Benchmarks of the counters on synthetic streams.
+ *
+ * Build and run:
+ *  $ g++ -O2 -std=c++17 -o bench bench.cpp
+ *  $ ./bench [options]
+ *
+ * Every engine counts the same stream, and the benchmark reports the
+ * throughput, the number of heap allocations per update, the peak memory
+ * of the engine, and the accuracy of its top-k items (precision, recall,
+ * and the maximum error of the counts) against the exact counts.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#ifdef  _WIN32
+#include <malloc.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif/*_WIN32*/
+
+#include "optparse.h"
+#include "countmin.h"
+#include "exact.h"
+#include "lossycounting.h"
+#include "misragries.h"
+#include "spacesaving.h"
+#include "spacesaving_PriorityQ.h"
+
+/// The number of heap allocations made by this process.
+static size_t g_num_allocs = 0;
+
+#if     defined(_MSC_VER)
+#define BENCH_NOINLINE  __declspec(noinline)
+#else
+#define BENCH_NOINLINE  __attribute__((noinline))
+#endif/*_MSC_VER*/
+
+/**
+ * Allocates a block for the replaced operator new (all forms).
+ *  @param  size    The size of the block in bytes.
+ *  @param  align   The alignment of the block, or zero for the default.
+ *  @return void*   The block, or \c NULL on failure.
+ */
+static void* counted_alloc(std::size_t size, std::size_t align)
+{
+    ++g_num_allocs;
+    if (size == 0) {
+        size = 1;
+    }
+#ifdef  _WIN32
+    return align ? _aligned_malloc(size, align) : std::malloc(size);
+#else
+    if (align < sizeof(void*)) {
+        return std::malloc(size);
+    }
+    void *p = NULL;
+    return (posix_memalign(&p, align, size) == 0) ? p : NULL;
+#endif/*_WIN32*/
+}
+
+/**
+ * Releases a block allocated by counted_alloc().
+ *  This function is kept out of line so that the compiler does not pair
+ *  a new-expression with the free() call of the replaced operator delete
+ *  (-Wmismatched-new-delete).
+ */
+static BENCH_NOINLINE void counted_free(void *p, std::size_t align)
+{
+#ifdef  _WIN32
+    if (align) {
+        _aligned_free(p);
+        return;
+    }
+#else
+    (void)align;
+#endif/*_WIN32*/
+    std::free(p);
+}
+
+static void* counted_new(std::size_t size, std::size_t align=0)
+{
+    void *p = counted_alloc(size, align);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(std::size_t size)
+{
+    return counted_new(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    return counted_new(size, (std::size_t)align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return counted_new(size, (std::size_t)align);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, 0);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, 0);
+}
+
+void operator delete(void *p) noexcept
+{
+    counted_free(p, 0);
+}
+
+void operator delete[](void *p) noexcept
+{
+    counted_free(p, 0);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    counted_free(p, 0);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    counted_free(p, 0);
+}
+
+void operator delete(void *p, std::align_val_t align) noexcept
+{
+    counted_free(p, (std::size_t)align);
+}
+
+void operator delete[](void *p, std::align_val_t align) noexcept
+{
+    counted_free(p, (std::size_t)align);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t align) noexcept
+{
+    counted_free(p, (std::size_t)align);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t align) noexcept
+{
+    counted_free(p, (std::size_t)align);
+}
+
+class option : public optparse
+{
+public:
+    std::string stream;
+    std::string engines;
+    size_t num_updates;
+    size_t vocabulary;
+    double skew;
+    size_t num_heavy;
+    size_t period;
+    int counters;
+    size_t top_k;
+    uint64_t seed;
+
+public:
+    option()
+        : stream("zipf"),
+        engines("exact,spacesaving,spacesaving_PriorityQ,countmin,misragries,lossycounting"),
+        num_updates(10000000), vocabulary(1000000), skew(1.0), num_heavy(100),
+        period(100000), counters(1024), top_k(100), seed(88172645463325252ULL)
+    {
+    }
+
+    BEGIN_OPTION_MAP_INLINE()
+        ON_OPTION_WITH_ARG(SHORTOPT('s') || LONGOPT("stream"))
+        stream = arg;
+
+        ON_OPTION_WITH_ARG(SHORTOPT('a') || LONGOPT("engines"))
+        engines = arg;
+
+        ON_OPTION_WITH_ARG(SHORTOPT('n') || LONGOPT("updates"))
+        num_updates = std::strtoul(arg, NULL, 10);
+
+        ON_OPTION_WITH_ARG(SHORTOPT('V') || LONGOPT("vocabulary"))
+        vocabulary = std::strtoul(arg, NULL, 10);
+
+        ON_OPTION_WITH_ARG(SHORTOPT('z') || LONGOPT("skew"))
+        skew = std::atof(arg);
+
+        ON_OPTION_WITH_ARG(SHORTOPT('H') || LONGOPT("heavy"))
+        num_heavy = std::strtoul(arg, NULL, 10);
+
+        ON_OPTION_WITH_ARG(SHORTOPT('p') || LONGOPT("period"))
+        period = std::strtoul(arg, NULL, 10);
+
+        ON_OPTION_WITH_ARG(SHORTOPT('e') || LONGOPT("epsilon"))
+        counters = std::atoi(arg);
+
+        ON_OPTION_WITH_ARG(SHORTOPT('k') || LONGOPT("top-k"))
+        top_k = std::strtoul(arg, NULL, 10);
+
+        ON_OPTION_WITH_ARG(LONGOPT("seed"))
+        seed = std::strtoull(arg, NULL, 10);
+
+    END_OPTION_MAP()
+};
+
+/**
+ * A pseudo-random number generator (xorshift64).
+ */
+class random_generator
+{
+protected:
+    uint64_t m_x;
+
+public:
+    random_generator(uint64_t seed) : m_x(seed ? seed : 1)
+    {
+    }
+
+    uint64_t next()
+    {
+        m_x ^= m_x << 13;
+        m_x ^= m_x >> 7;
+        m_x ^= m_x << 17;
+        return m_x;
+    }
+
+    /// Returns a uniform random number in [0, 1).
+    double uniform()
+    {
+        return (double)(next() >> 11) / (double)(1ULL << 53);
+    }
+};
+
+/**
+ * Generates a stream of keys.
+ *  zipf:           key i (1 <= i <= vocabulary) is drawn with probability
+ *                  proportional to 1/i^skew.
+ *  uniform:        every key of the vocabulary is equally likely.
+ *  adversarial:    a half of the updates goes to a set of heavy keys that
+ *                  is replaced every period updates, and the other half is
+ *                  uniform over the vocabulary, so that the heavy hitters
+ *                  of the past keep their counts while new ones emerge.
+ *  @return bool    \c false if the type of the stream is unknown.
+ */
+static bool generate_stream(std::vector<std::string>& stream, const option& opt)
+{
+    random_generator rng(opt.seed);
+    size_t vocabulary = std::max((size_t)1, opt.vocabulary);
+    stream.resize(opt.num_updates);
+
+    if (opt.stream == "zipf") {
+        // The cumulative distribution function for the inverse transform.
+        std::vector<double> cdf(vocabulary);
+        double sum = 0.;
+        for (size_t i = 0;i < vocabulary;++i) {
+            sum += 1. / std::pow((double)(i + 1), opt.skew);
+            cdf[i] = sum;
+        }
+        for (size_t i = 0;i < stream.size();++i) {
+            double u = rng.uniform() * sum;
+            size_t k = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            stream[i] = "token" + std::to_string(std::min(k, vocabulary - 1) + 1);
+        }
+    } else if (opt.stream == "uniform") {
+        for (size_t i = 0;i < stream.size();++i) {
+            stream[i] = "token" + std::to_string(rng.next() % vocabulary + 1);
+        }
+    } else if (opt.stream == "adversarial") {
+        size_t num_heavy = std::max((size_t)1, opt.num_heavy);
+        size_t period = std::max((size_t)1, opt.period);
+        for (size_t i = 0;i < stream.size();++i) {
+            uint64_t r = rng.next();
+            if (r & 1) {
+                size_t k = (i / period) * num_heavy + (r >> 1) % num_heavy;
+                stream[i] = "heavy" + std::to_string(k + 1);
+            } else {
+                stream[i] = "token" + std::to_string((r >> 1) % vocabulary + 1);
+            }
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+typedef exact<std::string, uint64_t> exact_t;
+typedef std::vector<std::pair<std::string, uint64_t> > ranking_t;
+
+/**
+ * The exact top-k items of the stream.
+ */
+struct truth_type
+{
+    exact_t counts;     ///< The exact counts.
+    ranking_t top;      ///< The top-k keys, in the descending order.
+};
+
+/**
+ * Collects the k items of a summary with the largest counts.
+ */
+template <class counter_type>
+static void collect_top(const counter_type& counter, size_t k, ranking_t& items)
+{
+    counter.items_above(0., [&](const typename counter_type::item_type& item) {
+        if (items.size() < k) {
+            items.push_back(std::make_pair(item.get_key(), (uint64_t)item.get_count()));
+        }
+    });
+}
+
+static void collect_top(const exact_t& counter, size_t k, ranking_t& items)
+{
+    items.assign(counter.begin(), counter.end());
+    std::sort(items.begin(), items.end(), [](const ranking_t::value_type& x, const ranking_t::value_type& y) {
+        return y.second < x.second || (x.second == y.second && x.first < y.first);
+    });
+    if (k < items.size()) {
+        items.resize(k);
+    }
+}
+
+/**
+ * Gets the peak resident set size of this process in MB.
+ */
+static double peak_rss()
+{
+#ifndef _WIN32
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef  __APPLE__
+    return ru.ru_maxrss / 1048576.;
+#else
+    return ru.ru_maxrss / 1024.;
+#endif/*__APPLE__*/
+#else
+    return 0.;
+#endif/*_WIN32*/
+}
+
+/**
+ * Counts the stream with an engine and reports the result.
+ *  The engine runs in a child process (where fork is available), so that
+ *  the peak RSS of the child measures the memory of the engine alone: the
+ *  growth of the peak over the RSS inherited from the parent.
+ *  @param  name    The name of the engine.
+ *  @param  create  The function returning a new engine.
+ *  @param  stream  The stream.
+ *  @param  truth   The exact counts and top-k items of the stream.
+ */
+template <class create_type>
+static void bench_counter(
+    const char *name,
+    create_type create,
+    const std::vector<std::string>& stream,
+    const truth_type& truth
+    )
+{
+#ifndef _WIN32
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        return;
+    } else if (0 < pid) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return;
+    }
+#endif/*_WIN32*/
+
+    double rss = peak_rss();
+    auto counter = create();
+    size_t allocs = g_num_allocs;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0;i < stream.size();++i) {
+        counter->append(stream[i]);
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    allocs = g_num_allocs - allocs;
+    rss = peak_rss() - rss;
+
+    // A reported item is a hit if its true count reaches the k-th largest
+    // count (so that ties at the k-th count are hits). Precision is the
+    // fraction of hits in the reported items; recall is the number of hits
+    // over k.
+    size_t k = truth.top.size();
+    ranking_t items;
+    collect_top(*counter, k, items);
+    uint64_t kth = (0 < k) ? truth.top.back().second : 0;
+    size_t hits = 0;
+    uint64_t max_error = 0;
+    for (size_t i = 0;i < items.size();++i) {
+        exact_t::const_iterator it = truth.counts.find(items[i].first);
+        uint64_t count = (it != truth.counts.end()) ? it->second : 0;
+        hits += (kth <= count && 0 < count);
+        max_error = std::max(max_error, (count < items[i].second) ? items[i].second - count : count - items[i].second);
+    }
+
+    double sec = std::chrono::duration<double>(end - begin).count();
+    std::printf(
+        "%-24s %12.0f %8.1f %8.4f %10.1f %9.4f %9.4f %10llu\n",
+        name,
+        stream.size() / sec,
+        sec * 1e9 / stream.size(),
+        (double)allocs / stream.size(),
+        rss,
+        items.empty() ? 0. : (double)hits / items.size(),
+        (0 < k) ? (double)hits / k : 0.,
+        (unsigned long long)max_error
+        );
+    std::fflush(stdout);
+
+#ifndef _WIN32
+    _exit(0);
+#endif/*_WIN32*/
+}
+
+static bool selected(const option& opt, const std::string& name)
+{
+    std::string list = "," + opt.engines + ",";
+    return list.find("," + name + ",") != std::string::npos;
+}
+
+int main(int argc, char *argv[])
+{
+    option opt;
+
+    try {
+        opt.parse(argv, argc);
+    } catch (const optparse::unrecognized_option& e) {
+        std::cerr << "ERROR: unrecognized option: " << e.what() << std::endl;
+        return 1;
+    }
+    if (opt.counters < 1) {
+        std::cerr << "ERROR: the number of counters must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> stream;
+    if (!generate_stream(stream, opt)) {
+        std::cerr << "ERROR: unrecognized stream: " << opt.stream << std::endl;
+        return 1;
+    }
+
+    truth_type truth;
+    for (size_t i = 0;i < stream.size();++i) {
+        truth.counts.append(stream[i]);
+    }
+    collect_top(truth.counts, opt.top_k, truth.top);
+
+    std::printf(
+        "# stream=%s updates=%zu vocabulary=%zu skew=%g heavy=%zu period=%zu distinct=%zu counters=%d top-k=%zu\n",
+        opt.stream.c_str(), stream.size(), opt.vocabulary, opt.skew,
+        opt.num_heavy, opt.period, truth.counts.size(), opt.counters, truth.top.size()
+        );
+    std::printf(
+        "%-24s %12s %8s %8s %10s %9s %9s %10s\n",
+        "# engine", "updates/sec", "ns/upd", "allocs", "peakRSS_MB",
+        "precision", "recall", "max_error"
+        );
+
+    int m = opt.counters;
+    if (selected(opt, "exact")) {
+        bench_counter("exact", []() {
+            return std::unique_ptr<exact_t>(new exact_t);
+        }, stream, truth);
+    }
+    if (selected(opt, "spacesaving")) {
+        bench_counter("spacesaving", [m]() {
+            return std::unique_ptr<spacesaving<std::string, uint64_t> >(
+                new spacesaving<std::string, uint64_t>(m));
+        }, stream, truth);
+    }
+    if (selected(opt, "spacesaving_PriorityQ")) {
+        bench_counter("spacesaving_PriorityQ", [m]() {
+            return std::unique_ptr<spacesaving_PriorityQ<std::string, uint64_t> >(
+                new spacesaving_PriorityQ<std::string, uint64_t>(m));
+        }, stream, truth);
+    }
+    if (selected(opt, "countmin")) {
+        bench_counter("countmin", [m]() {
+            return std::unique_ptr<countmin<std::string, uint64_t> >(
+                new countmin<std::string, uint64_t>(m, 0.01, m));
+        }, stream, truth);
+    }
+    if (selected(opt, "misragries")) {
+        bench_counter("misragries", [m]() {
+            return std::unique_ptr<misragries<std::string, uint64_t> >(
+                new misragries<std::string, uint64_t>(m));
+        }, stream, truth);
+    }
+    if (selected(opt, "lossycounting")) {
+        bench_counter("lossycounting", [m]() {
+            return std::unique_ptr<lossycounting<std::string, uint64_t> >(
+                new lossycounting<std::string, uint64_t>(m));
+        }, stream, truth);
+    }
+
+    return 0;
+}
@@ -0,0 +1,509 @@
+/*
+ *      Count-Min sketch.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __COUNTMIN_H__
+#define __COUNTMIN_H__
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "snapshot.h"
+
+/**
+ * Count-Min sketch with an optional heap of heavy hitters.
+ *  The sketch is a table of d rows and w columns of counters; a key is
+ *  counted in one column of every row chosen by a pairwise-independent
+ *  hash function of the row, and its count is estimated by the minimum of
+ *  the counters. With w = ceil(e/epsilon) and d = ceil(ln(1/delta)), an
+ *  estimate exceeds the true count by at most epsilon*N with probability
+ *  1-delta, where N is the total count. With the conservative update, a
+ *  counter is raised only as far as the new estimate of the key, which
+ *  reduces the overestimation without breaking the guarantee.
+ *
+ *  The sketch cannot enumerate keys; the k keys with the largest estimates
+ *  seen so far are kept in a min-heap for top-k queries.
+ *  @param  key_tmpl        Key type.
+ *  @param  count_tmpl      Count type.
+ */
+template <class key_tmpl, class count_tmpl=int>
+class countmin
+{
+public:
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// Count type.
+    typedef count_tmpl count_type;
+    /// This class.
+    typedef countmin<key_tmpl, count_tmpl> this_type;
+    /// The type for looking up a key (e.g., std::string_view for strings).
+    typedef typename key_traits<key_tmpl>::view_type key_view;
+
+    /// The maximum number of rows.
+    static const size_t max_depth = 32;
+
+    /**
+     * A heavy hitter.
+     */
+    class item_type
+    {
+        friend class countmin<key_tmpl, count_tmpl>;
+
+    protected:
+        key_type key;       ///< The key.
+        uint32_t hash;      ///< The hash value of the key.
+        count_type count;   ///< The estimated count.
+        mutable count_type eps; ///< The error bound (set when reported).
+
+    public:
+        item_type() : hash(0), count(0), eps(0)
+        {
+        }
+
+        const key_type& get_key() const
+        {
+            return this->key;
+        }
+
+        count_type get_count() const
+        {
+            return this->count;
+        }
+
+        /**
+         * Gets the bound of the overestimation (epsilon*N), which holds
+         * with probability 1-delta.
+         */
+        count_type get_epsilon() const
+        {
+            return this->eps;
+        }
+    };
+
+protected:
+    /// Key hashing.
+    typedef key_traits<key_type> traits_t;
+
+    /// The total count.
+    count_type m_n;
+    /// The number of columns.
+    uint32_t m_width;
+    /// The number of rows.
+    uint32_t m_depth;
+    /// Whether to use the conservative update.
+    bool m_conservative;
+    /// The parameters (a, b) of the hash function of every row.
+    std::vector<uint64_t> m_seeds;
+    /// The counters (m_depth rows of m_width columns).
+    std::vector<count_type> m_table;
+    /// The maximum number of heavy hitters.
+    size_t m_k;
+    /// The min-heap of heavy hitters.
+    std::vector<item_type> m_heap;
+    /// The mapping object: key -> position of the item in the heap.
+    keyindex m_index;
+    /// The scratch space for sorting items in queries.
+    mutable std::vector<uint32_t> m_order;
+
+public:
+    /**
+     * Constructs a sketch.
+     *  @param  m       The inverse of epsilon (the relative error bound).
+     *  @param  delta   The probability of exceeding the error bound.
+     *  @param  k       The number of heavy hitters to keep.
+     *  @param  conservative    \c true to use the conservative update.
+     */
+    countmin(count_type m=4, double delta=0.01, size_t k=0, bool conservative=true)
+        : m_n(0), m_width(0), m_depth(0), m_conservative(conservative),
+        m_k(k), m_index(k)
+    {
+        if (m < 1 || !(0. < delta && delta < 1.)) {
+            throw std::runtime_error("countmin: invalid epsilon or delta");
+        }
+        m_width = (uint32_t)std::ceil(std::exp(1.) * (double)m);
+        m_depth = (uint32_t)std::max(1., std::ceil(std::log(1. / delta)));
+        if (max_depth < m_depth) {
+            throw std::runtime_error("countmin: delta is too small");
+        }
+        m_table.assign((size_t)m_width * m_depth, 0);
+        m_heap.reserve(k);
+        m_order.reserve(k);
+
+        // Draw the hash functions from a fixed sequence (splitmix64), so
+        // that sketches of the same size can be merged.
+        uint64_t x = 0x2545F4914F6CDD1DULL;
+        m_seeds.resize(2 * m_depth);
+        for (size_t i = 0;i < m_seeds.size();++i) {
+            x += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            m_seeds[i] = z ^ (z >> 31);
+        }
+    }
+
+    virtual ~countmin()
+    {
+    }
+
+    /**
+     * Counts occurrences of a key.
+     *  @param  key     The key.
+     *  @param  count   The number of occurrences.
+     *  @return bool    \c true if the key entered the heap of heavy hitters.
+     */
+    bool append(const key_view& key, count_type count=1)
+    {
+        uint32_t hash = traits_t::hash(key);
+        uint32_t pos[max_depth];
+        uint32_t first = locate(hash, pos);
+        m_n += count;
+
+        count_type est;
+        if (m_conservative) {
+            est = m_table[first];
+            for (uint32_t i = 1;i < m_depth;++i) {
+                est = std::min(est, m_table[pos[i]]);
+            }
+            est += count;
+            for (uint32_t i = 0;i < m_depth;++i) {
+                m_table[pos[i]] = std::max(m_table[pos[i]], est);
+            }
+        } else {
+            m_table[first] += count;
+            est = m_table[first];
+            for (uint32_t i = 1;i < m_depth;++i) {
+                m_table[pos[i]] += count;
+                est = std::min(est, m_table[pos[i]]);
+            }
+        }
+        return update_heap(key, hash, est);
+    }
+
+    /**
+     * Estimates the count of a key.
+     *  @param  key     The key.
+     *  @return count_type  The estimated count (never smaller than the
+     *                      true count).
+     */
+    count_type estimate(const key_view& key) const
+    {
+        uint32_t pos[max_depth];
+        count_type est = m_table[locate(traits_t::hash(key), pos)];
+        for (uint32_t i = 1;i < m_depth;++i) {
+            est = std::min(est, m_table[pos[i]]);
+        }
+        return est;
+    }
+
+    /**
+     * Merges another sketch of the same size into this sketch.
+     *  The counters are added, and the heavy hitters of both sketches are
+     *  estimated again with the merged counters.
+     *  @param  other   The sketch to be merged into this sketch.
+     */
+    void merge(const countmin& other)
+    {
+        if (m_width != other.m_width || m_depth != other.m_depth || m_seeds != other.m_seeds) {
+            throw std::runtime_error("countmin: merging sketches of different sizes");
+        }
+        for (size_t i = 0;i < m_table.size();++i) {
+            m_table[i] += other.m_table[i];
+        }
+        m_n += other.m_n;
+
+        std::vector<item_type> candidates(m_heap);
+        candidates.insert(candidates.end(), other.m_heap.begin(), other.m_heap.end());
+        m_heap.clear();
+        m_index.clear();
+        for (size_t i = 0;i < candidates.size();++i) {
+            const item_type& item = candidates[i];
+            update_heap(item.key, item.hash, estimate(item.key));
+        }
+    }
+
+    /**
+     * Visits the k heavy hitters with the largest estimates.
+     *  @param  k       The maximum number of items to visit.
+     *  @param  visit   The function receiving an item (const item_type&).
+     *  @return size_t  The number of visited items.
+     */
+    template <class visitor_type>
+    size_t top_k(size_t k, visitor_type visit) const
+    {
+        k = std::min(k, m_heap.size());
+        sort_items(m_heap.size(), 0., k);
+        return visit_items(k, visit);
+    }
+
+    /**
+     * Visits the heavy hitters whose estimates are no smaller than a
+     * threshold, in the descending order of their estimates.
+     *  @param  threshold   The minimum estimate of items to visit.
+     *  @param  visit       The function receiving an item (const item_type&).
+     *  @return size_t      The number of visited items.
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        size_t n = sort_items(m_heap.size(), threshold, m_heap.size());
+        return visit_items(n, visit);
+    }
+
+    /**
+     * Saves the sketch to a snapshot file.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void save(const std::string& path) const
+    {
+        size_t n = m_heap.size();
+        std::vector<count_type> counts(n);
+        std::vector<uint32_t> hashes(n);
+        for (size_t i = 0;i < n;++i) {
+            counts[i] = m_heap[i].count;
+            hashes[i] = m_heap[i].hash;
+        }
+
+        snapshot_writer writer(path, SNAPSHOT_COUNTMIN, snapshot_key<key_type>::size, sizeof(count_type));
+        writer.put(m_n);
+        writer.put(m_width);
+        writer.put(m_depth);
+        writer.put(m_conservative ? 1 : 0);
+        writer.put(m_k);
+        writer.put_array(m_seeds.data(), m_seeds.size());
+        writer.put_array(m_table.data(), m_table.size());
+        writer.put(n);
+        writer.put_array(counts.data(), n);
+        writer.put_array(hashes.data(), n);
+        snapshot_put_keys<key_type>(writer, m_heap.begin(), n, [](const item_type& item) -> const key_type& {
+            return item.key;
+        });
+        writer.close();
+    }
+
+    /**
+     * Loads the sketch from a snapshot file.
+     *  This replaces the current state, including the size of the sketch.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void load(const std::string& path)
+    {
+        snapshot_reader reader(path, SNAPSHOT_COUNTMIN, snapshot_key<key_type>::size, sizeof(count_type));
+        count_type total = (count_type)reader.get();
+        uint64_t width = reader.get();
+        uint64_t depth = reader.get();
+        bool conservative = (reader.get() != 0);
+        size_t k = (size_t)reader.get();
+        if (width < 1 || 0xFFFFFFFF < width || depth < 1 || max_depth < depth) {
+            reader.fail();
+        }
+        const uint64_t *seeds = reader.get_array<uint64_t>(2 * depth);
+        const count_type *table = reader.get_array<count_type>(width * depth);
+        size_t n = (size_t)reader.get();
+        if (k < n) {
+            reader.fail();
+        }
+        const count_type *counts = reader.get_array<count_type>(n);
+        const uint32_t *hashes = reader.get_array<uint32_t>(n);
+
+        m_n = total;
+        m_width = (uint32_t)width;
+        m_depth = (uint32_t)depth;
+        m_conservative = conservative;
+        m_seeds.assign(seeds, seeds + 2 * depth);
+        m_table.assign(table, table + width * depth);
+        m_k = k;
+        m_index = keyindex(k);
+        m_heap.assign(n, item_type());
+        m_heap.reserve(k);
+        m_order.reserve(k);
+        for (size_t i = 0;i < n;++i) {
+            m_heap[i].count = counts[i];
+            m_heap[i].hash = hashes[i];
+            m_index.insert(hashes[i], (uint32_t)i);
+        }
+        snapshot_get_keys(reader, n, [&](size_t i, std::string_view bytes) {
+            return snapshot_key<key_type>::assign(m_heap[i].key, bytes);
+        });
+        for (size_t i = n / 2;0 < i;--i) {
+            downheap(i - 1);
+        }
+    }
+
+    count_type total() const
+    {
+        return m_n;
+    }
+
+    /**
+     * Gets the number of columns.
+     */
+    size_t width() const
+    {
+        return m_width;
+    }
+
+    /**
+     * Gets the number of rows.
+     */
+    size_t depth() const
+    {
+        return m_depth;
+    }
+
+protected:
+    /**
+     * Computes the position of the counter of a key in every row.
+     *  Row i hashes the key by ((a_i * x + b_i) >> 32) (multiply-add-shift),
+     *  and maps the hash value to a column by multiplication.
+     *  @return uint32_t    The position in the first row (pos[0]).
+     */
+    uint32_t locate(uint32_t hash, uint32_t *pos) const
+    {
+        const uint64_t *seeds = m_seeds.data();
+        pos[0] = column(hash, seeds[0], seeds[1]);
+        for (uint32_t i = 1;i < m_depth;++i) {
+            pos[i] = i * m_width + column(hash, seeds[2*i], seeds[2*i+1]);
+        }
+        return pos[0];
+    }
+
+    uint32_t column(uint32_t hash, uint64_t a, uint64_t b) const
+    {
+        uint32_t h = (uint32_t)((a * hash + b) >> 32);
+        return (uint32_t)(((uint64_t)h * m_width) >> 32);
+    }
+
+    bool update_heap(const key_view& key, uint32_t hash, count_type est)
+    {
+        if (m_k == 0) {
+            return false;
+        }
+        uint32_t i = m_index.find(hash, [&](uint32_t j) {
+            return m_heap[j].key == key;
+        });
+        if (i != keyindex::npos) {
+            m_heap[i].count = est;
+            downheap(i);
+            return false;
+        } else if (m_heap.size() < m_k) {
+            i = (uint32_t)m_heap.size();
+            m_heap.push_back(item_type());
+            m_heap[i].key = key;
+            m_heap[i].hash = hash;
+            m_heap[i].count = est;
+            m_index.insert(hash, i);
+            upheap(i);
+            return true;
+        } else if (m_heap[0].count < est) {
+            // Replace the heavy hitter with the smallest estimate.
+            m_index.erase(m_heap[0].hash, 0);
+            m_index.insert(hash, 0);
+            m_heap[0].key = key;
+            m_heap[0].hash = hash;
+            m_heap[0].count = est;
+            downheap(0);
+            return true;
+        }
+        return false;
+    }
+
+    void downheap(size_t i)
+    {
+        size_t n = m_heap.size();
+        for (;;) {
+            size_t c = 2 * i + 1;
+            if (n <= c) {
+                break;
+            }
+            if (c + 1 < n && m_heap[c+1].count < m_heap[c].count) {
+                ++c;
+            }
+            if (!(m_heap[c].count < m_heap[i].count)) {
+                break;
+            }
+            swap_items(i, c);
+            i = c;
+        }
+    }
+
+    void upheap(size_t i)
+    {
+        while (0 < i) {
+            size_t p = (i - 1) / 2;
+            if (!(m_heap[i].count < m_heap[p].count)) {
+                break;
+            }
+            swap_items(i, p);
+            i = p;
+        }
+    }
+
+    void swap_items(size_t i, size_t j)
+    {
+        m_index.swap(m_heap[i].hash, (uint32_t)i, m_heap[j].hash, (uint32_t)j);
+        std::swap(m_heap[i], m_heap[j]);
+    }
+
+    size_t sort_items(size_t n, double threshold, size_t k) const
+    {
+        m_order.clear();
+        for (size_t i = 0;i < n;++i) {
+            if (threshold <= m_heap[i].count) {
+                m_order.push_back((uint32_t)i);
+            }
+        }
+        k = std::min(k, m_order.size());
+        std::partial_sort(m_order.begin(), m_order.begin() + k, m_order.end(), [this](uint32_t i, uint32_t j) {
+            return m_heap[j].count < m_heap[i].count || (m_heap[j].count == m_heap[i].count && i < j);
+        });
+        return k;
+    }
+
+    template <class visitor_type>
+    size_t visit_items(size_t n, visitor_type visit) const
+    {
+        count_type eps = (count_type)std::ceil((double)m_n * std::exp(1.) / m_width);
+        for (size_t i = 0;i < n;++i) {
+            const item_type& item = m_heap[m_order[i]];
+            item.eps = eps;
+            visit(item);
+        }
+        return n;
+    }
+};
+
+#endif/*__COUNTMIN_H__*/
@@ -2,17 +2,27 @@
 #define __EXACT_H__
 
 #include <unordered_map>
+#include <vector>
+
+#include "keyindex.h"
+#include "snapshot.h"
+#include "stats.h"
 
 template <class key_type, class count_type=int>
-class exact : public std::unordered_map<key_type, count_type>
+class exact : public std::unordered_map<key_type, count_type, typename key_traits<key_type>::hasher>
 {
 protected:
     count_type m_n;
+    key_type m_buffer;
+    std::vector<const key_type*> *m_journal;
+    // The number of rehashes by append() (counted if USE_COUNTER_STATS is defined).
+    uint64_t m_rehashes;
 
 public:
-    typedef std::unordered_map<key_type, count_type> base_class;
+    typedef std::unordered_map<key_type, count_type, typename key_traits<key_type>::hasher> base_class;
+    typedef typename key_traits<key_type>::view_type key_view;
 
-    exact() : m_n(0)
+    exact() : m_n(0), m_journal(NULL), m_rehashes(0)
     {
     }
 
@@ -26,21 +36,104 @@ public:
         m_n = 0;
     }
 
-    void append(const key_type& key)
+    // Returns true if a counter was created for the key.
+    bool append(const key_view& key, count_type count=1)
     {
-        typename base_class::iterator it = this->find(key);
+        // Look up the key through a reusable buffer; the map copies it
+        // only when the key is new.
+        m_buffer = key;
+        m_n += count;
+        typename base_class::iterator it = this->find(m_buffer);
         if (it != this->end()) {
-            ++it->second;
+            it->second += count;
+            return false;
         } else {
-            this->insert(typename base_class::value_type(key, 1));
+            COUNTER_STATS(size_t num_buckets = this->bucket_count());
+            it = this->insert(typename base_class::value_type(m_buffer, count)).first;
+            COUNTER_STATS(m_rehashes += (num_buckets != this->bucket_count()));
+            if (m_journal != NULL) {
+                m_journal->push_back(&it->first);
+            }
+            return true;
+        }
+    }
+
+    // Counts occurrences of a batch of keys, as append() does for each.
+    // std::unordered_map exposes neither its hash slots nor a lookup by a
+    // precomputed hash, so the keys are applied one by one.
+    void append_batch(const key_view* keys, size_t n, const count_type* counts=NULL)
+    {
+        for (size_t i = 0;i < n;++i) {
+            append(keys[i], (counts != NULL) ? counts[i] : 1);
+        }
+    }
+
+    // Records the keys inserted from now on into the journal (if not NULL).
+    void record_insertions(std::vector<const key_type*> *journal)
+    {
+        m_journal = journal;
+    }
+
+    void merge(const exact& other)
+    {
+        for (typename base_class::const_iterator it = other.begin();it != other.end();++it) {
+            (*this)[it->first] += it->second;
         }
-        ++m_n;
+        m_n += other.m_n;
+        m_rehashes += other.m_rehashes;
+    }
+
+    void save(const std::string& path) const
+    {
+        std::vector<count_type> counts;
+        counts.reserve(this->size());
+        for (typename base_class::const_iterator it = this->begin();it != this->end();++it) {
+            counts.push_back(it->second);
+        }
+
+        snapshot_writer writer(path, SNAPSHOT_EXACT, snapshot_key<key_type>::size, sizeof(count_type));
+        writer.put(m_n);
+        writer.put(counts.size());
+        writer.put_array(counts.data(), counts.size());
+        snapshot_put_keys<key_type>(writer, this->begin(), counts.size(),
+            [](const typename base_class::value_type& x) -> const key_type& {
+            return x.first;
+        });
+        writer.close();
+    }
+
+    // Replaces the current state with the one stored in the snapshot file.
+    void load(const std::string& path)
+    {
+        snapshot_reader reader(path, SNAPSHOT_EXACT, snapshot_key<key_type>::size, sizeof(count_type));
+        count_type n = (count_type)reader.get();
+        size_t size = (size_t)reader.get();
+        const count_type *counts = reader.get_array<count_type>(size);
+
+        clear();
+        this->reserve(size);
+        snapshot_get_keys(reader, size, [&](size_t i, std::string_view bytes) {
+            key_type key;
+            if (!snapshot_key<key_type>::assign(key, bytes)) {
+                return false;
+            }
+            return this->insert(typename base_class::value_type(key, counts[i])).second;
+        });
+        m_n = n;
     }
 
     count_type total() const
     {
         return m_n;
     }
+
+    void write_stats(stats_writer& writer) const
+    {
+        writer.add("keys", (uint64_t)this->size());
+        writer.add("hash_buckets", (uint64_t)this->bucket_count());
+        writer.add("load_factor", (double)this->load_factor());
+        writer.add("rehashes", m_rehashes);
+    }
 };
 
 #endif/*__EXACT_H__*/
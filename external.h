@@ -0,0 +1,665 @@
+/*
+ *      Exact counting in external memory with sorted spill runs.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __EXTERNAL_H__
+#define __EXTERNAL_H__
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+
+#ifdef  _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif/*_WIN32*/
+
+#include "exact.h"
+#include "stats.h"
+
+/*
+ * A spill run is a file of (key, count) records in the ascending order of
+ * keys, without a header. Integers are written as varints (7 bits per byte,
+ * least significant group first). A record stores its key relative to the
+ * key of the previous record (an empty string or zero for the first one):
+ * an integer key as the difference, and a string key as the length of the
+ * common prefix and the length and characters of the rest (front coding).
+ * The count follows the key.
+ */
+
+/**
+ * A writer of a spill run.
+ */
+class run_writer
+{
+protected:
+    std::string m_path;
+    FILE *m_fp;
+    std::string m_buffer;
+    uint64_t m_size;
+
+public:
+    /**
+     * Creates a run file with a unique name in a directory.
+     *  @param  dir     The directory.
+     *  @throws         std::runtime_error
+     */
+    run_writer(const std::string& dir) : m_fp(NULL), m_size(0)
+    {
+        std::string pattern = dir + "/approxcounter-XXXXXX";
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+#ifdef  _WIN32
+        if (::_mktemp_s(&path[0], path.size()) == 0) {
+            m_fp = std::fopen(&path[0], "wb");
+        }
+#else
+        int fd = ::mkstemp(&path[0]);
+        if (0 <= fd) {
+            m_fp = ::fdopen(fd, "wb");
+            if (m_fp == NULL) {
+                ::close(fd);
+            }
+        }
+#endif/*_WIN32*/
+        if (m_fp == NULL) {
+            throw std::runtime_error("failed to create a temporary file in " + dir);
+        }
+        m_path = &path[0];
+    }
+
+    virtual ~run_writer()
+    {
+        if (m_fp != NULL) {
+            std::fclose(m_fp);
+            std::remove(m_path.c_str());
+        }
+    }
+
+private:
+    run_writer(const run_writer&);
+    run_writer& operator=(const run_writer&);
+
+public:
+    const std::string& path() const
+    {
+        return m_path;
+    }
+
+    /**
+     * Gets the number of bytes written so far.
+     */
+    uint64_t size() const
+    {
+        return m_size + m_buffer.size();
+    }
+
+    void put_varint(uint64_t value)
+    {
+        while (0x80 <= value) {
+            m_buffer.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        m_buffer.push_back((char)value);
+        if (buffer_size <= m_buffer.size()) {
+            flush();
+        }
+    }
+
+    void put_bytes(const char *data, size_t size)
+    {
+        m_buffer.append(data, size);
+        if (buffer_size <= m_buffer.size()) {
+            flush();
+        }
+    }
+
+    /**
+     * Finishes writing the run.
+     *  @throws         std::runtime_error
+     */
+    void close()
+    {
+        flush();
+        FILE *fp = m_fp;
+        m_fp = NULL;
+        if (std::fclose(fp) != 0) {
+            std::remove(m_path.c_str());
+            throw std::runtime_error("failed to write the temporary file: " + m_path);
+        }
+    }
+
+protected:
+    static constexpr size_t buffer_size = 1 << 16;
+
+    void flush()
+    {
+        if (!m_buffer.empty() && std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_fp) != m_buffer.size()) {
+            throw std::runtime_error("failed to write the temporary file: " + m_path);
+        }
+        m_size += m_buffer.size();
+        m_buffer.clear();
+    }
+};
+
+/**
+ * A reader of a spill run.
+ */
+class run_reader
+{
+protected:
+    std::string m_path;
+    FILE *m_fp;
+    std::vector<char> m_buffer;
+    size_t m_begin;
+    size_t m_end;
+
+public:
+    /**
+     * Opens a run file.
+     *  @param  path    The path to the run file.
+     *  @throws         std::runtime_error
+     */
+    run_reader(const std::string& path)
+        : m_path(path), m_fp(NULL), m_buffer(1 << 16), m_begin(0), m_end(0)
+    {
+        m_fp = std::fopen(path.c_str(), "rb");
+        if (m_fp == NULL) {
+            throw std::runtime_error("failed to open the temporary file: " + path);
+        }
+    }
+
+    virtual ~run_reader()
+    {
+        if (m_fp != NULL) {
+            std::fclose(m_fp);
+        }
+    }
+
+private:
+    run_reader(const run_reader&);
+    run_reader& operator=(const run_reader&);
+
+public:
+    /**
+     * Tests whether the reader reached the end of the run.
+     */
+    bool eof()
+    {
+        return m_begin == m_end && !fill();
+    }
+
+    uint64_t get_varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0;shift < 64;shift += 7) {
+            if (m_begin == m_end && !fill()) {
+                break;
+            }
+            unsigned char c = (unsigned char)m_buffer[m_begin++];
+            value |= (uint64_t)(c & 0x7F) << shift;
+            if (c < 0x80) {
+                return value;
+            }
+        }
+        throw std::runtime_error("broken temporary file: " + m_path);
+    }
+
+    void get_bytes(std::string& out, size_t size)
+    {
+        while (0 < size) {
+            if (m_begin == m_end && !fill()) {
+                throw std::runtime_error("broken temporary file: " + m_path);
+            }
+            size_t n = std::min(size, m_end - m_begin);
+            out.append(&m_buffer[m_begin], n);
+            m_begin += n;
+            size -= n;
+        }
+    }
+
+protected:
+    bool fill()
+    {
+        m_begin = 0;
+        m_end = std::fread(&m_buffer[0], 1, m_buffer.size(), m_fp);
+        if (m_end == 0 && std::ferror(m_fp)) {
+            throw std::runtime_error("failed to read the temporary file: " + m_path);
+        }
+        return 0 < m_end;
+    }
+};
+
+/**
+ * Encoding of keys in spill runs (integer keys).
+ */
+template <class key_type>
+struct run_key
+{
+    static void put(run_writer& writer, const key_type& prev, const key_type& key)
+    {
+        writer.put_varint((uint64_t)(key - prev));
+    }
+
+    static void get(run_reader& reader, key_type& key)
+    {
+        key += (key_type)reader.get_varint();
+    }
+
+    /// The memory of a key outside of the hash table.
+    static size_t memory(const key_type&)
+    {
+        return 0;
+    }
+};
+
+/**
+ * Encoding of keys in spill runs (string keys, front-coded).
+ */
+template <>
+struct run_key<std::string>
+{
+    static void put(run_writer& writer, const std::string& prev, const std::string& key)
+    {
+        size_t n = std::min(prev.size(), key.size());
+        size_t shared = std::mismatch(key.begin(), key.begin() + n, prev.begin()).first - key.begin();
+        writer.put_varint(shared);
+        writer.put_varint(key.size() - shared);
+        writer.put_bytes(key.data() + shared, key.size() - shared);
+    }
+
+    static void get(run_reader& reader, std::string& key)
+    {
+        size_t shared = (size_t)reader.get_varint();
+        size_t size = (size_t)reader.get_varint();
+        if (key.size() < shared) {
+            throw std::runtime_error("broken temporary file");
+        }
+        key.resize(shared);
+        reader.get_bytes(key, size);
+    }
+
+    /// The memory of a key outside of the hash table (beyond the capacity
+    /// of the small-string buffer).
+    static size_t memory(std::string_view key)
+    {
+        return (sizeof(std::string) <= key.size()) ? key.size() + 1 : 0;
+    }
+};
+
+/**
+ * An exact counter spilling its counts to sorted runs in external memory.
+ *  The counts are accumulated in an exact counter until its estimated
+ *  memory reaches a budget. The counter is then sorted by keys and written
+ *  to a run file in a temporary directory, and emptied. The runs are kept in
+ *  levels: as soon as a level has max_fan_in runs, they are merged by a
+ *  k-way merge (adding up the counts of the same key) into a run of the
+ *  next level, so that the number of run files grows logarithmically with
+ *  the input. At the end, the remaining runs are merged in the same way, so
+ *  that the memory stays bounded by the budget plus a buffer per run. If
+ *  the counts never exceeded the budget, the counter is used as is.
+ *  @param  key_tmpl        Key type.
+ *  @param  count_tmpl      Count type.
+ */
+template <class key_tmpl, class count_tmpl=int>
+class external_exact
+{
+public:
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// Count type.
+    typedef count_tmpl count_type;
+    /// The in-memory counter.
+    typedef exact<key_type, count_type> counter_type;
+    /// The type for looking up a key.
+    typedef typename counter_type::key_view key_view;
+
+protected:
+    /// The in-memory counter.
+    counter_type m_counter;
+    /// The budget of the memory of the in-memory counter, in bytes.
+    size_t m_memory_limit;
+    /// The directory of the run files.
+    std::string m_temp_dir;
+    /// The paths to the run files by level; a run of level l+1 is a merge
+    /// of max_fan_in runs of level l.
+    std::vector<std::vector<std::string> > m_levels;
+    /// The number of the run files.
+    size_t m_num_runs;
+    /// The estimated memory of the keys in the in-memory counter.
+    size_t m_memory;
+    /// The total of the spilled counts.
+    count_type m_n;
+    /// The number of keys written to the runs.
+    uint64_t m_spilled_keys;
+    /// The number of bytes written to the runs.
+    uint64_t m_spilled_bytes;
+
+    /// The maximum number of runs merged at once.
+    static constexpr size_t max_fan_in = 64;
+
+public:
+    /// The smallest budget of memory; a smaller budget would spill a run
+    /// for every few keys.
+    static constexpr size_t min_memory_limit = 1 << 20;
+
+    /**
+     * Constructs an object.
+     *  @param  memory_limit    The budget of memory in bytes (raised to
+     *                          min_memory_limit if smaller).
+     *  @param  temp_dir        The directory for the run files (empty for
+     *                          $TMPDIR, or /tmp).
+     */
+    external_exact(size_t memory_limit, const std::string& temp_dir)
+        : m_memory_limit(std::max(memory_limit, min_memory_limit)), m_temp_dir(temp_dir),
+        m_num_runs(0), m_memory(0), m_n(0), m_spilled_keys(0), m_spilled_bytes(0)
+    {
+        if (m_temp_dir.empty()) {
+            const char *dir = std::getenv("TMPDIR");
+            m_temp_dir = (dir != NULL && *dir) ? dir : "/tmp";
+        }
+    }
+
+    /**
+     * Destructs the object and removes the run files.
+     */
+    virtual ~external_exact()
+    {
+        remove_runs();
+    }
+
+private:
+    external_exact(const external_exact&);
+    external_exact& operator=(const external_exact&);
+
+public:
+    /**
+     * Counts occurrences of a key.
+     *  @param  key     The key.
+     *  @param  count   The number of occurrences.
+     *  @return bool    \c true if the key was not in the in-memory counter.
+     */
+    bool append(const key_view& key, count_type count=1)
+    {
+        if (!m_counter.append(key, count)) {
+            return false;
+        }
+        m_memory += node_size + run_key<key_type>::memory(key);
+        if (m_memory_limit <= memory()) {
+            spill();
+        }
+        return true;
+    }
+
+    /**
+     * Visits the keys and their counts.
+     *  Without runs, the keys are visited in the order of the in-memory
+     *  counter (as the output of an in-memory run). Otherwise, the counter
+     *  is spilled, and the keys are visited in the ascending order while
+     *  the runs are merged.
+     *  @param  visit   The function receiving a key (const key_type&) and
+     *                  its count.
+     *  @throws         std::runtime_error
+     */
+    template <class visitor_type>
+    void for_each(visitor_type visit)
+    {
+        if (m_num_runs == 0) {
+            typename counter_type::const_iterator it;
+            for (it = m_counter.begin();it != m_counter.end();++it) {
+                visit(it->first, it->second);
+            }
+            return;
+        }
+        if (!m_counter.empty()) {
+            spill();
+        }
+
+        // Merge the lower levels until the runs can be opened at once.
+        for (size_t level = 0;max_fan_in < m_num_runs;++level) {
+            if (1 < m_levels[level].size()) {
+                merge_level(level);
+            }
+        }
+
+        std::vector<std::string> runs;
+        for (size_t level = 0;level < m_levels.size();++level) {
+            runs.insert(runs.end(), m_levels[level].begin(), m_levels[level].end());
+        }
+        merge_runs(runs, visit);
+    }
+
+    void save(const std::string& path) const
+    {
+        if (0 < m_num_runs) {
+            throw std::runtime_error("snapshots are not supported once the counts are spilled (--memory-limit)");
+        }
+        m_counter.save(path);
+    }
+
+    void load(const std::string& path)
+    {
+        remove_runs();
+        m_counter.load(path);
+        m_n = 0;
+        m_memory = 0;
+        typename counter_type::const_iterator it;
+        for (it = m_counter.begin();it != m_counter.end();++it) {
+            m_memory += node_size + run_key<key_type>::memory(it->first);
+        }
+        if (m_memory_limit <= memory()) {
+            spill();
+        }
+    }
+
+    count_type total() const
+    {
+        return m_n + m_counter.total();
+    }
+
+    void write_stats(stats_writer& writer) const
+    {
+        writer.add("memory_limit", (uint64_t)m_memory_limit);
+        writer.add("runs", (uint64_t)m_num_runs);
+        writer.add("levels", (uint64_t)m_levels.size());
+        writer.add("spilled_keys", m_spilled_keys);
+        writer.add("spilled_bytes", m_spilled_bytes);
+        writer.begin("in_memory");
+        m_counter.write_stats(writer);
+        writer.end();
+    }
+
+protected:
+    /// The estimated size of a node of the hash table (the key, the count,
+    /// the link and the cached hash value, and the allocation overhead).
+    static constexpr size_t node_size = sizeof(typename counter_type::value_type) + 3 * sizeof(void*);
+
+    size_t memory() const
+    {
+        return m_memory + m_counter.bucket_count() * sizeof(void*);
+    }
+
+    /**
+     * Writes the in-memory counter to a new run and empties it.
+     *  @throws         std::runtime_error
+     */
+    void spill()
+    {
+        typedef typename counter_type::value_type value_type;
+        std::vector<const value_type*> items;
+        items.reserve(m_counter.size());
+        typename counter_type::const_iterator it;
+        for (it = m_counter.begin();it != m_counter.end();++it) {
+            items.push_back(&*it);
+        }
+        std::sort(items.begin(), items.end(), [](const value_type *x, const value_type *y) {
+            return x->first < y->first;
+        });
+
+        run_writer writer(m_temp_dir);
+        key_type prev = key_type();
+        for (size_t i = 0;i < items.size();++i) {
+            run_key<key_type>::put(writer, prev, items[i]->first);
+            writer.put_varint((uint64_t)items[i]->second);
+            prev = items[i]->first;
+        }
+        writer.close();
+        m_spilled_keys += items.size();
+        m_spilled_bytes += writer.size();
+
+        m_n += m_counter.total();
+        m_counter.clear();
+        m_counter.rehash(0);
+        m_memory = 0;
+
+        add_run(writer.path(), 0);
+    }
+
+    /**
+     * Adds a run to a level, and merges the level into a run of the next
+     * level once it has max_fan_in runs.
+     *  @throws         std::runtime_error
+     */
+    void add_run(const std::string& path, size_t level)
+    {
+        if (m_levels.size() <= level) {
+            m_levels.resize(level + 1);
+        }
+        m_levels[level].push_back(path);
+        ++m_num_runs;
+        if (max_fan_in <= m_levels[level].size()) {
+            merge_level(level);
+        }
+    }
+
+    /**
+     * Merges the runs of a level into a run of the next level.
+     *  @throws         std::runtime_error
+     */
+    void merge_level(size_t level)
+    {
+        std::vector<std::string>& runs = m_levels[level];
+        run_writer writer(m_temp_dir);
+        key_type prev = key_type();
+        merge_runs(runs, [&](const key_type& key, count_type count) {
+            run_key<key_type>::put(writer, prev, key);
+            writer.put_varint((uint64_t)count);
+            prev = key;
+        });
+        writer.close();
+        m_spilled_bytes += writer.size();
+
+        for (size_t i = 0;i < runs.size();++i) {
+            std::remove(runs[i].c_str());
+        }
+        m_num_runs -= runs.size();
+        runs.clear();
+        add_run(writer.path(), level + 1);
+    }
+
+    /// The cursor of a run in a k-way merge.
+    struct cursor_t
+    {
+        std::unique_ptr<run_reader> reader;
+        key_type key;
+        count_type count;
+
+        bool next()
+        {
+            if (reader->eof()) {
+                return false;
+            }
+            run_key<key_type>::get(*reader, key);
+            count = (count_type)reader->get_varint();
+            return true;
+        }
+    };
+
+    /**
+     * Merges runs and visits the keys with the sums of their counts, in the
+     * ascending order of keys.
+     */
+    template <class visitor_type>
+    static void merge_runs(const std::vector<std::string>& runs, visitor_type visit)
+    {
+        std::vector<cursor_t> cursors(runs.size());
+        auto greater = [&cursors](size_t i, size_t j) {
+            return cursors[j].key < cursors[i].key;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+        for (size_t i = 0;i < runs.size();++i) {
+            cursors[i].reader.reset(new run_reader(runs[i]));
+            cursors[i].key = key_type();
+            if (cursors[i].next()) {
+                heap.push(i);
+            }
+        }
+
+        while (!heap.empty()) {
+            size_t i = heap.top();
+            heap.pop();
+            key_type key = cursors[i].key;
+            count_type count = cursors[i].count;
+            if (cursors[i].next()) {
+                heap.push(i);
+            }
+            while (!heap.empty() && !(key < cursors[heap.top()].key)) {
+                size_t j = heap.top();
+                heap.pop();
+                count += cursors[j].count;
+                if (cursors[j].next()) {
+                    heap.push(j);
+                }
+            }
+            visit(key, count);
+        }
+    }
+
+    void remove_runs()
+    {
+        for (size_t level = 0;level < m_levels.size();++level) {
+            for (size_t i = 0;i < m_levels[level].size();++i) {
+                std::remove(m_levels[level][i].c_str());
+            }
+        }
+        m_levels.clear();
+        m_num_runs = 0;
+    }
+};
+
+#endif/*__EXTERNAL_H__*/
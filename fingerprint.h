@@ -0,0 +1,246 @@
+/*
+ *      Counting 64-bit fingerprints of string keys.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FINGERPRINT_H__
+#define __FINGERPRINT_H__
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "stats.h"
+
+/**
+ * Computes the 64-bit fingerprint of a string.
+ *  @param  str     The string.
+ *  @return uint64_t    The fingerprint.
+ */
+inline uint64_t fingerprint64(std::string_view str)
+{
+    const char *p = str.data();
+    size_t n = str.size();
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)n;
+    for (;8 <= n;p += 8, n -= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, sizeof(w));
+        h = (h ^ integer_key_traits<uint64_t>::mix(w)) * 0x9E3779B97F4A7C15ULL;
+    }
+    if (0 < n) {
+        uint64_t w = 0;
+        std::memcpy(&w, p, n);
+        h = (h ^ integer_key_traits<uint64_t>::mix(w)) * 0x9E3779B97F4A7C15ULL;
+    }
+    return integer_key_traits<uint64_t>::mix(h);
+}
+
+/**
+ * A summary counting 64-bit fingerprints of string keys.
+ *  The underlying summary (e.g., spacesaving<uint64_t, count_type>) stores
+ *  fingerprints instead of strings, and a side table keeps the strings of
+ *  the fingerprints to which counters were assigned. The side table is
+ *  cleaned up whenever it grows beyond twice the number of counters, so
+ *  that it holds the strings of the surviving keys only. Two keys with the
+ *  same fingerprint are counted as one key (with the string of the first).
+ *  @param  counter_tmpl    The summary of uint64_t keys.
+ */
+template <class counter_tmpl>
+class fingerprint_counter
+{
+public:
+    /// The underlying summary.
+    typedef counter_tmpl counter_type;
+    /// Count type.
+    typedef typename counter_type::count_type count_type;
+    /// Key type.
+    typedef std::string key_type;
+    /// The type for looking up a key.
+    typedef std::string_view key_view;
+
+    /**
+     * A count item presenting the string of a fingerprint.
+     */
+    class item_type
+    {
+    protected:
+        const typename counter_type::item_type& m_item;
+        const std::string& m_key;
+
+    public:
+        item_type(const typename counter_type::item_type& item, const std::string& key)
+            : m_item(item), m_key(key)
+        {
+        }
+
+        const std::string& get_key() const
+        {
+            return m_key;
+        }
+
+        count_type get_count() const
+        {
+            return m_item.get_count();
+        }
+
+        count_type get_epsilon() const
+        {
+            return m_item.get_epsilon();
+        }
+    };
+
+protected:
+    /// The summary of fingerprints.
+    counter_type m_counter;
+    /// The side table: fingerprint -> string.
+    std::unordered_map<uint64_t, std::string, key_traits<uint64_t>::hasher> m_keys;
+    /// The size of the side table triggering a cleanup.
+    size_t m_limit;
+
+public:
+    /**
+     * Constructs an object.
+     *  @param  m       The maximum number of counters.
+     *  @param  args    The other arguments for the underlying summary.
+     */
+    template <class... arg_types>
+    fingerprint_counter(count_type m, arg_types... args)
+        : m_counter(m, args...), m_limit(2 * (size_t)m)
+    {
+    }
+
+    virtual ~fingerprint_counter()
+    {
+    }
+
+    /**
+     * Counts an occurrence of a key.
+     *  @return bool    \c true if a counter was assigned to the key.
+     */
+    bool append(const key_view& key)
+    {
+        uint64_t fp = fingerprint64(key);
+        return observe(fp, key, m_counter.append(fp));
+    }
+
+    /**
+     * Counts occurrences of a key.
+     *  This is available if the underlying summary accepts weighted updates.
+     *  @return bool    \c true if a counter was assigned to the key.
+     */
+    template <class counter_class = counter_type>
+    auto append(const key_view& key, const count_type& freq)
+        -> decltype(std::declval<counter_class&>().append(uint64_t(), freq), bool())
+    {
+        uint64_t fp = fingerprint64(key);
+        return observe(fp, key, m_counter.append(fp, freq));
+    }
+
+    /**
+     * Merges another summary into this summary.
+     */
+    void merge(const fingerprint_counter& other)
+    {
+        m_counter.merge(other.m_counter);
+        m_keys.insert(other.m_keys.begin(), other.m_keys.end());
+        collect();
+    }
+
+    /**
+     * Visits the items whose counts are no smaller than a threshold.
+     *  @see    counter_type::items_above()
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        return m_counter.items_above(threshold, [&](const typename counter_type::item_type& item) {
+            visit(item_type(item, m_keys.find(item.get_key())->second));
+        });
+    }
+
+    void save(const std::string&) const
+    {
+        throw std::runtime_error("snapshots of fingerprint counters are not supported");
+    }
+
+    void load(const std::string&)
+    {
+        throw std::runtime_error("snapshots of fingerprint counters are not supported");
+    }
+
+    count_type total() const
+    {
+        return m_counter.total();
+    }
+
+    /**
+     * Writes the statistics of the underlying summary and the side table.
+     *  @param  writer  The writer.
+     */
+    void write_stats(stats_writer& writer) const
+    {
+        write_counter_stats(writer, m_counter);
+        writer.add("side_table_keys", (uint64_t)m_keys.size());
+    }
+
+protected:
+    bool observe(uint64_t fp, const key_view& key, bool created)
+    {
+        if (created) {
+            m_keys.emplace(fp, key);
+            if (m_limit < m_keys.size()) {
+                collect();
+            }
+        }
+        return created;
+    }
+
+    /**
+     * Removes the strings of the fingerprints without counters.
+     */
+    void collect()
+    {
+        std::unordered_map<uint64_t, std::string, key_traits<uint64_t>::hasher> keys;
+        keys.reserve(m_limit);
+        m_counter.items_above(0., [&](const typename counter_type::item_type& item) {
+            keys.insert(m_keys.extract(item.get_key()));
+        });
+        m_keys.swap(keys);
+        // A summary may keep more than m keys (e.g., a sketch with a large
+        // heap); clean up no more often than every m_keys.size() keys.
+        m_limit = std::max(m_limit, 2 * m_keys.size());
+    }
+};
+
+#endif/*__FINGERPRINT_H__*/
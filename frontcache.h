@@ -0,0 +1,249 @@
+/*
+ *      Front cache coalescing repeated updates of hot keys.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FRONTCACHE_H__
+#define __FRONTCACHE_H__
+
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "stats.h"
+
+template <class counter_type, class = void>
+struct has_weighted_append : std::false_type
+{
+};
+
+template <class counter_type>
+struct has_weighted_append<counter_type, std::void_t<decltype(
+    std::declval<counter_type&>().append(
+        std::declval<const typename counter_type::key_view&>(),
+        std::declval<typename counter_type::count_type>()))> >
+    : std::true_type
+{
+};
+
+/**
+ * A direct-mapped cache of pending updates in front of a summary.
+ *  A skewed stream repeats a few keys again and again. The cache holds a
+ *  key and its pending count per entry, so that the repeated occurrences
+ *  of a key add up in the entry without touching the summary. An entry
+ *  is flushed into the summary as one weighted update when another key
+ *  takes it over, and all entries are flushed before any query, merge, or
+ *  snapshot (the entries are mutable for this reason).
+ *
+ *  The summary receives the same total count per key as without the
+ *  cache, but later and in fewer updates. The summaries depend on the
+ *  order of updates (e.g., Space-Saving replaces the minimum counter, and
+ *  Count-Min's conservative update takes the minimum of the rows), so they
+ *  keep their error bounds, but the reported counts and errors may differ
+ *  from those without the cache. main.cpp therefore requires
+ *  --approximate-cache along with --front-cache.
+ *  @param  counter_tmpl    The summary, which must accept weighted updates
+ *                          (append(key, count)).
+ */
+template <class counter_tmpl>
+class front_cache
+{
+public:
+    /// The underlying summary.
+    typedef counter_tmpl counter_type;
+    /// Key type.
+    typedef typename counter_type::key_type key_type;
+    /// Count type.
+    typedef typename counter_type::count_type count_type;
+    /// The type for looking up a key.
+    typedef typename counter_type::key_view key_view;
+    /// Count item.
+    typedef typename counter_type::item_type item_type;
+
+    static_assert(has_weighted_append<counter_type>::value, "front_cache requires weighted updates");
+
+protected:
+    /// An entry of the cache.
+    struct entry_t
+    {
+        key_type key;       ///< The key.
+        uint32_t hash;      ///< The hash value of the key.
+        count_type count;   ///< The pending count (zero if the entry is empty).
+
+        entry_t() : key(), hash(0), count(0)
+        {
+        }
+    };
+
+    /// Key hashing.
+    typedef key_traits<key_type> traits_t;
+    /// The underlying summary.
+    mutable counter_type m_counter;
+    /// The entries.
+    mutable std::vector<entry_t> m_entries;
+    /// The mask for computing an entry position from a hash value.
+    uint32_t m_mask;
+
+    /**
+     * Statistics of the cache (counted if USE_COUNTER_STATS is defined).
+     */
+    struct stats_t
+    {
+        uint64_t hits;      ///< Updates coalesced into pending counts.
+        uint64_t flushes;   ///< Pending counts written to the summary.
+    };
+    mutable stats_t m_stats;
+
+public:
+    /**
+     * Constructs an object.
+     *  @param  size    The number of entries (rounded up to a power of 2).
+     *  @param  args    The arguments for constructing the summary.
+     */
+    template <class... arg_types>
+    front_cache(size_t size, arg_types... args)
+        : m_counter(args...), m_mask(0), m_stats()
+    {
+        size_t n = 1;
+        while (n < size) {
+            n *= 2;
+        }
+        m_entries.resize(n);
+        m_mask = (uint32_t)(n - 1);
+    }
+
+    virtual ~front_cache()
+    {
+    }
+
+    /**
+     * Counts occurrences of a key.
+     *  @param  key     The key.
+     *  @param  count   The number of occurrences.
+     */
+    void append(const key_view& key, count_type count=1)
+    {
+        if (count == 0) {
+            return;
+        }
+        uint32_t hash = traits_t::hash(key);
+        entry_t& entry = m_entries[hash & m_mask];
+        if (entry.count != 0) {
+            if (entry.hash == hash && entry.key == key) {
+                COUNTER_STATS(++m_stats.hits);
+                entry.count += count;
+                return;
+            }
+            flush(entry);
+        }
+        entry.key = key;
+        entry.hash = hash;
+        entry.count = count;
+    }
+
+    /**
+     * Writes all pending counts to the summary.
+     */
+    void flush() const
+    {
+        for (size_t i = 0;i < m_entries.size();++i) {
+            if (m_entries[i].count != 0) {
+                flush(m_entries[i]);
+            }
+        }
+    }
+
+    /**
+     * Merges another summary into this summary.
+     */
+    void merge(const front_cache& other)
+    {
+        flush();
+        other.flush();
+        m_counter.merge(other.m_counter);
+        m_stats.hits += other.m_stats.hits;
+        m_stats.flushes += other.m_stats.flushes;
+    }
+
+    /**
+     * Visits the items whose counts are no smaller than a threshold.
+     *  @see    counter_type::items_above()
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        flush();
+        return m_counter.items_above(threshold, visit);
+    }
+
+    void save(const std::string& path) const
+    {
+        flush();
+        m_counter.save(path);
+    }
+
+    void load(const std::string& path)
+    {
+        for (size_t i = 0;i < m_entries.size();++i) {
+            m_entries[i].count = 0;
+        }
+        m_counter.load(path);
+    }
+
+    count_type total() const
+    {
+        flush();
+        return m_counter.total();
+    }
+
+    /**
+     * Writes the statistics of the summary and the cache.
+     *  @param  writer  The writer.
+     */
+    void write_stats(stats_writer& writer) const
+    {
+        flush();
+        write_counter_stats(writer, m_counter);
+        writer.add("front_cache_entries", (uint64_t)m_entries.size());
+        writer.add("front_cache_hits", m_stats.hits);
+        writer.add("front_cache_flushes", m_stats.flushes);
+    }
+
+protected:
+    void flush(entry_t& entry) const
+    {
+        COUNTER_STATS(++m_stats.flushes);
+        m_counter.append(entry.key, entry.count);
+        entry.count = 0;
+    }
+};
+
+#endif/*__FRONTCACHE_H__*/
@@ -0,0 +1,385 @@
+/*
+ *      Bounded-capacity open-addressing key index.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __KEYINDEX_H__
+#define __KEYINDEX_H__
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cassert>
+#include <stdint.h>
+
+#if     defined(__GNUC__)
+#define KEYINDEX_PREFETCH(p)    __builtin_prefetch(p)
+#elif   defined(_MSC_VER)
+#include <xmmintrin.h>
+#define KEYINDEX_PREFETCH(p)    _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define KEYINDEX_PREFETCH(p)
+#endif
+
+/**
+ * Hashing and lookup views of keys stored in a keyindex.
+ *  A counter accepts keys as view_type, compares them against the stored
+ *  keys without conversion, and materializes a key_type object only when
+ *  it creates a counter for a new key.
+ *  @param  key_tmpl        Key type.
+ */
+template <class key_tmpl>
+struct key_traits
+{
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// The type for looking up a key.
+    typedef key_tmpl view_type;
+    /// The hash function for standard containers.
+    typedef std::hash<key_tmpl> hasher;
+
+    /**
+     * Computes the 32-bit hash value of a key.
+     *  @param  key     The key.
+     *  @return uint32_t    The hash value.
+     */
+    static uint32_t hash(const view_type& key)
+    {
+        return fold(std::hash<view_type>()(key));
+    }
+
+    /**
+     * Folds a hash value into 32 bits.
+     *  @param  h       The hash value.
+     *  @return uint32_t    The folded hash value.
+     */
+    static uint32_t fold(uint64_t h)
+    {
+        return (uint32_t)(h ^ (h >> 32));
+    }
+};
+
+/**
+ * Hashing of integer keys.
+ *  Integer keys are scrambled by a mixing function (the finalizer of
+ *  MurmurHash3), since std::hash may be the identity function, which would
+ *  cluster sequential IDs in the open-addressing index.
+ */
+template <class key_tmpl>
+struct integer_key_traits
+{
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// The type for looking up a key.
+    typedef key_tmpl view_type;
+
+    /**
+     * Mixes the bits of a 64-bit value.
+     *  @param  h       The value.
+     *  @return uint64_t    The mixed value.
+     */
+    static uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /**
+     * Computes the 32-bit hash value of a key.
+     *  @param  key     The key.
+     *  @return uint32_t    The hash value.
+     */
+    static uint32_t hash(view_type key)
+    {
+        return (uint32_t)mix((uint64_t)key);
+    }
+
+    /// The hash function for standard containers.
+    struct hasher
+    {
+        size_t operator()(view_type key) const
+        {
+            return (size_t)mix((uint64_t)key);
+        }
+    };
+};
+
+template <>
+struct key_traits<uint32_t> : public integer_key_traits<uint32_t>
+{
+};
+
+template <>
+struct key_traits<uint64_t> : public integer_key_traits<uint64_t>
+{
+};
+
+/**
+ * Hashing and lookup views of string keys.
+ *  Strings are looked up by std::string_view, which hashes to the same
+ *  value as std::string.
+ */
+template <>
+struct key_traits<std::string> : public key_traits<std::string_view>
+{
+    /// Key type.
+    typedef std::string key_type;
+    /// The hash function for standard containers.
+    typedef std::hash<std::string> hasher;
+};
+
+/**
+ * An open-addressing hash index from keys to 32-bit values.
+ *  The index does not store keys: it stores a precomputed hash value and a
+ *  value (typically, the position of an item in a pool that holds the key)
+ *  per slot, and lets the caller compare keys through a predicate. The
+ *  number of slots is fixed at construction (a power of two at least twice
+ *  the capacity), and collisions are resolved by linear probing with
+ *  backward-shift deletion, so that neither insertions nor deletions
+ *  allocate memory.
+ */
+class keyindex
+{
+public:
+    /// The value representing an empty slot or a missing key.
+    static const uint32_t npos = 0xFFFFFFFF;
+
+protected:
+    /// A slot of the hash table.
+    struct slot_t
+    {
+        uint32_t hash;      ///< The hash value of the key.
+        uint32_t value;     ///< The value associated with the key.
+    };
+
+    /// The hash table.
+    std::vector<slot_t> m_slots;
+    /// The mask for computing a slot position from a hash value.
+    uint32_t m_mask;
+    /// The number of values in the table.
+    size_t m_size;
+
+public:
+    /**
+     * Constructs an index.
+     *  @param  capacity    The maximum number of keys.
+     */
+    keyindex(size_t capacity=0) : m_mask(0), m_size(0)
+    {
+        size_t n = 8;
+        while (n < capacity * 2) {
+            n *= 2;
+        }
+        slot_t empty = {0, npos};
+        m_slots.assign(n, empty);
+        m_mask = (uint32_t)(n - 1);
+    }
+
+    /**
+     * Destructs the index.
+     */
+    virtual ~keyindex()
+    {
+    }
+
+    /**
+     * Removes all values.
+     */
+    void clear()
+    {
+        slot_t empty = {0, npos};
+        m_slots.assign(m_slots.size(), empty);
+        m_size = 0;
+    }
+
+    /**
+     * Gets the number of values in the index.
+     *  @return size_t      The number of values.
+     */
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * Gets the number of slots.
+     *  @return size_t      The number of slots.
+     */
+    size_t num_slots() const
+    {
+        return m_slots.size();
+    }
+
+    /**
+     * Gets the slots as an array of num_slots() pairs of (hash, value).
+     *  @return const uint32_t*     The pointer to the slots.
+     */
+    const uint32_t *data() const
+    {
+        return &m_slots[0].hash;
+    }
+
+    /**
+     * Restores the slots from an array of num_slots() pairs of
+     * (hash, value), e.g., a copy of data() of an index of the same size.
+     *  @param  data    The pointer to the slots.
+     *  @param  size    The number of values in the slots.
+     */
+    void assign(const uint32_t *data, size_t size)
+    {
+        std::memcpy(&m_slots[0], data, sizeof(slot_t) * m_slots.size());
+        m_size = size;
+    }
+
+    /**
+     * Finds the value associated with a key.
+     *  @param  hash    The hash value of the key.
+     *  @param  equal   The predicate that receives a value and returns
+     *                  \c true if the value corresponds to the key.
+     *  @return uint32_t    The value, or npos if the key is not found.
+     */
+    template <class equal_type>
+    uint32_t find(uint32_t hash, equal_type equal) const
+    {
+        for (uint32_t i = hash & m_mask;;i = (i + 1) & m_mask) {
+            const slot_t& slot = m_slots[i];
+            if (slot.value == npos) {
+                return npos;
+            }
+            if (slot.hash == hash && equal(slot.value)) {
+                return slot.value;
+            }
+        }
+    }
+
+    /**
+     * Prefetches the home slot of a key into the cache.
+     *  @param  hash    The hash value of the key.
+     */
+    void prefetch(uint32_t hash) const
+    {
+        KEYINDEX_PREFETCH(&m_slots[hash & m_mask]);
+    }
+
+    /**
+     * Gets the value in the home slot of a key without probing.
+     *  This is a hint for prefetching the item of a key: the value may
+     *  belong to another key, and it is npos if the slot is empty.
+     *  @param  hash    The hash value of the key.
+     *  @return uint32_t    The value in the home slot.
+     */
+    uint32_t peek(uint32_t hash) const
+    {
+        const slot_t& slot = m_slots[hash & m_mask];
+        return (slot.hash == hash) ? slot.value : npos;
+    }
+
+    /**
+     * Inserts a value for a key that does not exist in the index.
+     *  @param  hash    The hash value of the key.
+     *  @param  value   The value.
+     */
+    void insert(uint32_t hash, uint32_t value)
+    {
+        assert(m_size < m_slots.size() / 2);
+        uint32_t i = hash & m_mask;
+        while (m_slots[i].value != npos) {
+            i = (i + 1) & m_mask;
+        }
+        m_slots[i].hash = hash;
+        m_slots[i].value = value;
+        ++m_size;
+    }
+
+    /**
+     * Replaces a value in the index.
+     *  @param  hash    The hash value of the key associated with the value.
+     *  @param  value   The value to be replaced; it must exist in the index.
+     *  @param  newval  The new value.
+     */
+    void replace(uint32_t hash, uint32_t value, uint32_t newval)
+    {
+        m_slots[locate(hash, value)].value = newval;
+    }
+
+    /**
+     * Exchanges the values of two keys in the index.
+     *  @param  hash1   The hash value of the first key.
+     *  @param  value1  The value of the first key.
+     *  @param  hash2   The hash value of the second key.
+     *  @param  value2  The value of the second key.
+     */
+    void swap(uint32_t hash1, uint32_t value1, uint32_t hash2, uint32_t value2)
+    {
+        uint32_t i = locate(hash1, value1);
+        uint32_t j = locate(hash2, value2);
+        m_slots[i].value = value2;
+        m_slots[j].value = value1;
+    }
+
+    /**
+     * Removes a value from the index.
+     *  @param  hash    The hash value of the key associated with the value.
+     *  @param  value   The value to be removed; it must exist in the index.
+     */
+    void erase(uint32_t hash, uint32_t value)
+    {
+        uint32_t i = locate(hash, value);
+
+        // Shift back the following slots of the cluster so that every
+        // value stays reachable from its home slot without tombstones.
+        for (uint32_t j = (i + 1) & m_mask;m_slots[j].value != npos;j = (j + 1) & m_mask) {
+            uint32_t home = m_slots[j].hash & m_mask;
+            if (((j - home) & m_mask) >= ((j - i) & m_mask)) {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i].value = npos;
+        --m_size;
+    }
+
+protected:
+    uint32_t locate(uint32_t hash, uint32_t value) const
+    {
+        uint32_t i = hash & m_mask;
+        while (m_slots[i].value != value) {
+            assert(m_slots[i].value != npos);
+            i = (i + 1) & m_mask;
+        }
+        return i;
+    }
+};
+
+#endif/*__KEYINDEX_H__*/
@@ -0,0 +1,376 @@
+/*
+ *      Lossy Counting algorithm.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LOSSYCOUNTING_H__
+#define __LOSSYCOUNTING_H__
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "snapshot.h"
+
+/**
+ * Lossy Counting algorithm.
+ *  The stream is divided into buckets of m updates. A key entering the
+ *  table in bucket b gets the count f=1 and the maximum error b-1, and the
+ *  entries whose f plus error does not exceed the current bucket number are
+ *  pruned at the end of every bucket, in one sweep over the table. The cost
+ *  of a sweep is amortized over the m updates of a bucket.
+ *
+ *  An item stores its count plus its error (an upper bound of the true
+ *  count, like the count of Space-Saving) and its error as epsilon. A key
+ *  without an entry occurred at most (number of the bucket) times. Unlike
+ *  Space-Saving, the number of entries is not fixed; it is O(m log(n/m)).
+ *  @param  key_tmpl        Key type.
+ *  @param  count_tmpl      Count type.
+ */
+template <class key_tmpl, class count_tmpl=int>
+class lossycounting
+{
+public:
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// Count type.
+    typedef count_tmpl count_type;
+    /// This class.
+    typedef lossycounting<key_tmpl, count_tmpl> this_type;
+    /// The type for looking up a key (e.g., std::string_view for strings).
+    typedef typename key_traits<key_tmpl>::view_type key_view;
+
+    /**
+     * A count item.
+     */
+    class item_type
+    {
+        friend class lossycounting<key_tmpl, count_tmpl>;
+
+    protected:
+        key_type key;       ///< The key.
+        uint32_t hash;      ///< The hash value of the key.
+        mutable uint32_t rank;  ///< The position in the order of iteration.
+        count_type count;   ///< The count plus the error (upper bound).
+        count_type eps;     ///< The error (overestimation).
+
+    public:
+        item_type() : hash(0), rank(0), count(0), eps(0)
+        {
+        }
+
+        const key_type& get_key() const
+        {
+            return this->key;
+        }
+
+        count_type get_count() const
+        {
+            return this->count;
+        }
+
+        count_type get_epsilon() const
+        {
+            return this->eps;
+        }
+    };
+
+protected:
+    /// Key hashing.
+    typedef key_traits<key_type> traits_t;
+    /// The mapping object: key -> position of the item in the table.
+    keyindex m_keys;
+    /// The capacity of the key index.
+    size_t m_capacity;
+    /// The total frequency.
+    count_type m_n;
+    /// The width of a bucket (1/epsilon).
+    count_type m_m;
+    /// The table of items.
+    std::vector<item_type> m_items;
+    /// The positions of items in the order of iteration.
+    mutable std::vector<uint32_t> m_order;
+
+public:
+    /**
+     * Constructs an object.
+     *  @param  m       The width of a bucket (the inverse of epsilon).
+     */
+    lossycounting(count_type m=4)
+        : m_keys(2 * (size_t)m), m_capacity(2 * (size_t)m), m_n(0), m_m(m)
+    {
+        m_items.reserve(m_capacity);
+    }
+
+    virtual ~lossycounting()
+    {
+    }
+
+    /**
+     * Counts an occurrence of a key.
+     *  @param  key     The key.
+     *  @return bool    \c true if an entry was created for the key.
+     */
+    bool append(const key_view& key)
+    {
+        uint32_t hash = traits_t::hash(key);
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        ++m_n;
+        if (i != keyindex::npos) {
+            ++m_items[i].count;
+        } else {
+            count_type bucket = (m_n + m_m - 1) / m_m;
+            push_item(key, hash, bucket, bucket - 1);
+        }
+        if (m_n % m_m == 0) {
+            prune(m_n / m_m);
+        }
+        return i == keyindex::npos;
+    }
+
+    /**
+     * Merges another summary into this summary.
+     *  A key missing in a summary is regarded to have the number of the
+     *  current bucket of the summary as its count and error; the counts and
+     *  errors are added, and the entries are pruned at the current bucket
+     *  of the merged stream.
+     *  @param  other   The summary to be merged into this summary.
+     */
+    void merge(const lossycounting& other)
+    {
+        count_type b1 = (m_n + m_m - 1) / m_m;
+        count_type b2 = (other.m_n + other.m_m - 1) / other.m_m;
+        std::vector<item_type> items;
+        items.reserve(m_items.size() + other.m_items.size());
+        for (size_t i = 0;i < m_items.size();++i) {
+            item_type item = m_items[i];
+            const item_type *x = other.find(item.key, item.hash);
+            item.count += (x != NULL) ? x->count : b2;
+            item.eps += (x != NULL) ? x->eps : b2;
+            items.push_back(item);
+        }
+        for (size_t i = 0;i < other.m_items.size();++i) {
+            const item_type& x = other.m_items[i];
+            if (this->find(x.key, x.hash) == NULL) {
+                item_type item = x;
+                item.count += b1;
+                item.eps += b1;
+                items.push_back(item);
+            }
+        }
+
+        m_n += other.m_n;
+        m_items.swap(items);
+        prune(m_n / m_m);
+    }
+
+    /**
+     * Gets the item with the largest count.
+     *  The order of iteration is computed by this function, and it is
+     *  valid until the summary is updated.
+     *  @return item_type*  The item, or NULL if the summary is empty.
+     */
+    item_type *top()
+    {
+        sort_items();
+        return m_order.empty() ? NULL : &m_items[m_order[0]];
+    }
+
+    /**
+     * Gets the item following an item in the order of iteration.
+     *  @return item_type*  The item, or NULL at the end.
+     */
+    item_type *next(item_type *cur)
+    {
+        size_t r = cur->rank + 1;
+        return (r < m_order.size()) ? &m_items[m_order[r]] : NULL;
+    }
+
+    /**
+     * Visits the items whose counts are no smaller than a threshold, in
+     * the descending order of their counts.
+     *  @param  threshold   The minimum count of items to visit.
+     *  @param  visit       The function receiving an item (const item_type&).
+     *  @return size_t      The number of visited items.
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        sort_items();
+        size_t n = 0;
+        for (;n < m_order.size() && threshold <= m_items[m_order[n]].count;++n) {
+            visit(m_items[m_order[n]]);
+        }
+        return n;
+    }
+
+    /**
+     * Saves the summary to a snapshot file.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void save(const std::string& path) const
+    {
+        size_t n = m_items.size();
+        std::vector<count_type> counts(n), eps(n);
+        std::vector<uint32_t> hashes(n);
+        for (size_t i = 0;i < n;++i) {
+            counts[i] = m_items[i].count;
+            eps[i] = m_items[i].eps;
+            hashes[i] = m_items[i].hash;
+        }
+
+        snapshot_writer writer(path, SNAPSHOT_LOSSYCOUNTING, snapshot_key<key_type>::size, sizeof(count_type));
+        writer.put(m_n);
+        writer.put(m_m);
+        writer.put(n);
+        writer.put_array(counts.data(), n);
+        writer.put_array(eps.data(), n);
+        writer.put_array(hashes.data(), n);
+        snapshot_put_keys<key_type>(writer, m_items.begin(), n, [](const item_type& item) -> const key_type& {
+            return item.key;
+        });
+        writer.close();
+    }
+
+    /**
+     * Loads the summary from a snapshot file.
+     *  This replaces the current state, including the width of a bucket.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void load(const std::string& path)
+    {
+        snapshot_reader reader(path, SNAPSHOT_LOSSYCOUNTING, snapshot_key<key_type>::size, sizeof(count_type));
+        count_type total = (count_type)reader.get();
+        count_type m = (count_type)reader.get();
+        size_t n = (size_t)reader.get();
+        if (m < 1) {
+            reader.fail();
+        }
+        const count_type *counts = reader.get_array<count_type>(n);
+        const count_type *eps = reader.get_array<count_type>(n);
+        const uint32_t *hashes = reader.get_array<uint32_t>(n);
+
+        m_items.assign(n, item_type());
+        for (size_t i = 0;i < n;++i) {
+            m_items[i].count = counts[i];
+            m_items[i].eps = eps[i];
+            m_items[i].hash = hashes[i];
+        }
+        snapshot_get_keys(reader, n, [&](size_t i, std::string_view bytes) {
+            return snapshot_key<key_type>::assign(m_items[i].key, bytes);
+        });
+        m_n = total;
+        m_m = m;
+        reindex();
+    }
+
+    count_type total() const
+    {
+        return m_n;
+    }
+
+protected:
+    const item_type *find(const key_view& key, uint32_t hash) const
+    {
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        return (i != keyindex::npos) ? &m_items[i] : NULL;
+    }
+
+    void push_item(const key_view& key, uint32_t hash, count_type count, count_type eps)
+    {
+        if (m_items.size() == m_capacity) {
+            // Double the capacity of the key index.
+            reindex();
+        }
+        uint32_t i = (uint32_t)m_items.size();
+        m_items.push_back(item_type());
+        item_type& item = m_items.back();
+        item.key = key;
+        item.hash = hash;
+        item.count = count;
+        item.eps = eps;
+        m_keys.insert(hash, i);
+    }
+
+    /**
+     * Removes the entries whose counts do not exceed a bucket number.
+     */
+    void prune(count_type bucket)
+    {
+        size_t n = 0;
+        for (size_t i = 0;i < m_items.size();++i) {
+            if (bucket < m_items[i].count) {
+                if (n != i) {
+                    m_items[n] = std::move(m_items[i]);
+                }
+                ++n;
+            }
+        }
+        m_items.resize(n);
+        reindex();
+    }
+
+    void reindex()
+    {
+        if (m_capacity < m_items.size() + 1) {
+            while (m_capacity < m_items.size() + 1) {
+                m_capacity *= 2;
+            }
+            m_keys = keyindex(m_capacity);
+        } else {
+            m_keys.clear();
+        }
+        for (size_t i = 0;i < m_items.size();++i) {
+            m_keys.insert(m_items[i].hash, (uint32_t)i);
+        }
+    }
+
+    void sort_items() const
+    {
+        m_order.resize(m_items.size());
+        for (size_t i = 0;i < m_items.size();++i) {
+            m_order[i] = (uint32_t)i;
+        }
+        std::sort(m_order.begin(), m_order.end(), [this](uint32_t i, uint32_t j) {
+            return m_items[j].count < m_items[i].count || (m_items[j].count == m_items[i].count && i < j);
+        });
+        for (size_t r = 0;r < m_order.size();++r) {
+            m_items[m_order[r]].rank = (uint32_t)r;
+        }
+    }
+};
+
+#endif/*__LOSSYCOUNTING_H__*/
@@ -1,14 +1,62 @@
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <stdint.h>
 
 #include "optparse.h"
+#include "pipeline.h"
+#include "countmin.h"
 #include "exact.h"
+#include "external.h"
+#include "fingerprint.h"
+#include "frontcache.h"
+#include "lossycounting.h"
+#include "misragries.h"
 #include "spacesaving.h"
 #include "spacesaving_PriorityQ.h"
+#include "reader.h"
+#include "stats.h"
 #include "tokenize.h"
+#include "windowed.h"
+#include "writer.h"
 
+/**
+ * Parses a size in bytes with an optional suffix (K, M, G).
+ *  @param  arg     The string.
+ *  @return uint64_t    The size in bytes.
+ *  @throws         optparse::invalid_value
+ */
+static uint64_t parse_size(const char *arg)
+{
+    char *end = NULL;
+    uint64_t size = std::strtoull(arg, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+        size <<= 10;
+        // Fall through.
+    case 'M': case 'm':
+        size <<= 10;
+        // Fall through.
+    case 'K': case 'k':
+        size <<= 10;
+        ++end;
+        break;
+    }
+    if (end == arg || *end != '\0') {
+        throw optparse::invalid_value(std::string("invalid size: ") + arg);
+    }
+    return size;
+}
 
 class option : public optparse
 {
@@ -16,17 +64,34 @@ public:
     bool help;
     std::string algorithm;
     std::string type;
+    std::string key_type;
+    std::string save_state;
+    std::string load_state;
     int epsilon;
     int token_field;
     int freq_field;
+    int threads;
+    double delta;
+    int top_k;
     double support;
     bool absolute_support;
+    bool stats;
+    uint64_t window;
+    int window_epochs;
+    double decay;
+    bool pipeline;
+    int front_cache;
+    bool approximate_cache;
+    uint64_t memory_limit;
+    std::string temp_dir;
 	
 public:
     option()
-	: help(false), algorithm("exact"), type("uint32"), epsilon(1024),
-	token_field(1), freq_field(2),
-	support(0.), absolute_support(false)
+	: help(false), algorithm("exact"), type("uint32"), key_type("string"), epsilon(1024),
+	token_field(1), freq_field(2), threads(1), delta(0.01), top_k(0),
+	support(0.), absolute_support(false), stats(false),
+	window(0), window_epochs(10), decay(0.), pipeline(false), front_cache(0),
+	approximate_cache(false), memory_limit(0)
     {
     }
 	
@@ -37,12 +102,18 @@ public:
 	ON_OPTION_WITH_ARG(SHORTOPT('c') || LONGOPT("type"))
 	type = arg;
 	
+	ON_OPTION_WITH_ARG(LONGOPT("key-type"))
+	key_type = arg;
+	
 	ON_OPTION_WITH_ARG(SHORTOPT('t') || LONGOPT("token-field"))
 	token_field = std::atoi(arg);
 	
 	ON_OPTION_WITH_ARG(SHORTOPT('f') || LONGOPT("freq-field"))
 	freq_field = std::atoi(arg);
 	
+	ON_OPTION_WITH_ARG(SHORTOPT('T') || LONGOPT("threads"))
+	threads = std::atoi(arg);
+	
 	ON_OPTION_WITH_ARG(SHORTOPT('s') || LONGOPT("support"))
 	support = std::atof(arg);
 	absolute_support = false;
@@ -54,123 +125,982 @@ public:
 	ON_OPTION_WITH_ARG(SHORTOPT('e') || LONGOPT("epsilon"))
 	epsilon = std::atoi(arg);
 	
+	ON_OPTION_WITH_ARG(SHORTOPT('d') || LONGOPT("delta"))
+	delta = std::atof(arg);
+	
+	ON_OPTION_WITH_ARG(SHORTOPT('k') || LONGOPT("top-k"))
+	top_k = std::atoi(arg);
+	
+	ON_OPTION_WITH_ARG(LONGOPT("save-state"))
+	save_state = arg;
+	
+	ON_OPTION_WITH_ARG(LONGOPT("load-state"))
+	load_state = arg;
+	
+	ON_OPTION_WITH_ARG(LONGOPT("window"))
+	window = std::strtoull(arg, NULL, 10);
+	
+	ON_OPTION_WITH_ARG(LONGOPT("window-epochs"))
+	window_epochs = std::atoi(arg);
+	
+	ON_OPTION_WITH_ARG(LONGOPT("decay"))
+	decay = std::atof(arg);
+	
+	ON_OPTION(LONGOPT("pipeline"))
+	pipeline = true;
+	
+	ON_OPTION_WITH_ARG(LONGOPT("front-cache"))
+	front_cache = std::atoi(arg);
+	
+	ON_OPTION(LONGOPT("approximate-cache"))
+	approximate_cache = true;
+	
+	ON_OPTION_WITH_ARG(LONGOPT("memory-limit"))
+	memory_limit = parse_size(arg);
+	
+	ON_OPTION_WITH_ARG(LONGOPT("temp-dir"))
+	temp_dir = arg;
+	
+	ON_OPTION(LONGOPT("stats"))
+	stats = true;
+	
 	ON_OPTION(SHORTOPT('h') || LONGOPT("help"))
 	help = true;
 	
     END_OPTION_MAP()
 };
 
+static void usage(std::ostream& os, const char *argv0)
+{
+    os << "USAGE: " << argv0 << " [OPTIONS] < INPUT" << std::endl;
+    os << "Counts the lines (or the tokens and frequencies) read from STDIN." << std::endl;
+    os << std::endl;
+    os << "OPTIONS:" << std::endl;
+    os << "  -a, --algorithm=NAME     exact, sum, spacesaving, spacesaving-sum," << std::endl;
+    os << "                           spacesaving-heap-sum, misragries, lossycounting," << std::endl;
+    os << "                           or countmin (default: exact)" << std::endl;
+    os << "  -c, --type=TYPE          count type: uint16, uint32, or uint64 (default: uint32)" << std::endl;
+    os << "      --key-type=TYPE      key type: string, uint32, uint64, or hash64 (default: string)" << std::endl;
+    os << "  -t, --token-field=N      the field of the token in sum input (default: 1)" << std::endl;
+    os << "  -f, --freq-field=N       the field of the frequency in sum input (default: 2)" << std::endl;
+    os << "  -T, --threads=N          the number of counting threads (default: 1)" << std::endl;
+    os << "  -e, --epsilon=N          the number of counters (the width for countmin)" << std::endl;
+    os << "                           (default: 1024)" << std::endl;
+    os << "  -d, --delta=VALUE        the failure probability of countmin (default: 0.01)" << std::endl;
+    os << "  -k, --top-k=N            the number of heavy hitters of countmin" << std::endl;
+    os << "                           (default: --epsilon)" << std::endl;
+    os << "  -s, --support=VALUE      report the items above a ratio of the total" << std::endl;
+    os << "  -S, --absolute-support=VALUE" << std::endl;
+    os << "                           report the items above a count" << std::endl;
+    os << "      --save-state=PATH    save the summary to a snapshot file" << std::endl;
+    os << "      --load-state=PATH    resume counting from a snapshot file" << std::endl;
+    os << "      --window=N           count the last N lines (in --window-epochs epochs)" << std::endl;
+    os << "      --window-epochs=N    the number of epochs of --window (default: 10)" << std::endl;
+    os << "      --decay=VALUE        count with exponential decay per line" << std::endl;
+    os << "      --pipeline           overlap reading, splitting, and counting" << std::endl;
+    os << "      --front-cache=N      coalesce repeated keys in an N-entry cache in front" << std::endl;
+    os << "                           of the summary; the summary sees the updates in a" << std::endl;
+    os << "                           different order, so the reported counts and errors" << std::endl;
+    os << "                           may differ (within the error bounds) from a run" << std::endl;
+    os << "                           without the cache (requires --approximate-cache)" << std::endl;
+    os << "      --approximate-cache  accept the changed results of --front-cache" << std::endl;
+    os << "      --memory-limit=SIZE  spill the exact counts to --temp-dir beyond SIZE" << std::endl;
+    os << "                           bytes (K, M, G suffixes; at least 1M)" << std::endl;
+    os << "      --temp-dir=DIR       the directory of the spilled runs (default: $TMPDIR)" << std::endl;
+    os << "      --stats              print statistics to STDERR" << std::endl;
+    os << "  -h, --help               show this help message and exit" << std::endl;
+}
+
+
+/**
+ * Keys given as strings (--key-type string).
+ */
+struct string_keys
+{
+    typedef std::string key_type;
+
+    /// The summary counting the keys.
+    template <class counter_class>
+    struct summary
+    {
+        typedef counter_class type;
+    };
+
+    static std::string_view parse(std::string_view token)
+    {
+        return token;
+    }
+};
+
+/**
+ * Keys given as decimal integers (--key-type uint32, uint64).
+ */
+template <class integer_type>
+struct integer_keys
+{
+    typedef integer_type key_type;
+
+    /// The summary counting the keys.
+    template <class counter_class>
+    struct summary
+    {
+        typedef counter_class type;
+    };
+
+    static integer_type parse(std::string_view token)
+    {
+        integer_type key;
+        if (!parse_count(token, key)) {
+            throw std::runtime_error("invalid key: " + std::string(token));
+        }
+        return key;
+    }
+};
+
+/**
+ * String keys counted as 64-bit fingerprints (--key-type hash64).
+ */
+struct fingerprint_keys
+{
+    typedef uint64_t key_type;
+
+    /// The summary counting the keys.
+    template <class counter_class>
+    struct summary
+    {
+        typedef fingerprint_counter<counter_class> type;
+    };
+
+    static std::string_view parse(std::string_view token)
+    {
+        return token;
+    }
+};
 
+/**
+ * Restores the state of a counter if --load-state is specified.
+ */
 template <class counter_class>
-void count_data(counter_class& counter, std::istream& is)
+void load_state(counter_class& counter, const option& opt)
 {
-    for (;;) {
-        std::string line;
-        std::getline(is, line);
-        if (is.eof()) {
-            break;
+    if (!opt.load_state.empty()) {
+        counter.load(opt.load_state);
+    }
+}
+
+/**
+ * Saves the state of a counter if --save-state is specified.
+ */
+template <class counter_class>
+void save_state(const counter_class& counter, const option& opt)
+{
+    if (!opt.save_state.empty()) {
+        counter.save(opt.save_state);
+    }
+}
+
+/**
+ * Processes the blocks of the input with multiple threads.
+ *  Every thread reads line-aligned blocks of the input one after another.
+ *  @param  reader      The reader of the input.
+ *  @param  num_threads The number of threads.
+ *  @param  on_read     The function receiving the thread number after the
+ *                      thread read a block (called while holding the lock
+ *                      of the reader, i.e., in the order of the blocks).
+ *  @param  on_block    The function receiving the thread number and the
+ *                      block (called concurrently).
+ */
+template <class read_handler_class, class block_handler_class>
+void process_blocks(
+    line_reader& reader,
+    int num_threads,
+    read_handler_class on_read,
+    block_handler_class on_block
+    )
+{
+    std::vector<std::thread> threads;
+    std::exception_ptr error;
+    std::mutex mutex;
+
+    for (int i = 0;i < num_threads;++i) {
+        threads.push_back(std::thread([&, i]() {
+            try {
+                std::vector<char> buffer;
+                std::string_view block;
+                for (;;) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!reader.read_block(buffer, block)) {
+                            break;
+                        }
+                        on_read(i);
+                    }
+                    on_block(i, block);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+            }
+        }));
+    }
+    for (int i = 0;i < num_threads;++i) {
+        threads[i].join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * Passes the lines of the input to a handler in order, on this thread.
+ *  @param  reader      The reader of the input.
+ *  @param  pipeline    Whether to read and split the input on separate
+ *                      threads (--pipeline), overlapping them with the
+ *                      handler.
+ *  @param  handler     The function receiving a line.
+ */
+template <class handler_class>
+void read_lines(line_reader& reader, bool pipeline, handler_class handler)
+{
+    if (pipeline) {
+        line_pipeline(reader).run(handler);
+        return;
+    }
+    std::string_view line;
+    while (reader.next(line)) {
+        handler(line);
+    }
+}
+
+/// The maximum number of lines passed to a handler at once.
+static constexpr size_t line_batch_size = 4096;
+
+/**
+ * Passes the lines of a block to a handler in batches.
+ *  @param  block       The block of lines.
+ *  @param  lines       The buffer for the views of the lines.
+ *  @param  handler     The function receiving an array of lines and its
+ *                      size.
+ */
+template <class handler_class>
+void split_line_batches(std::string_view block, std::vector<std::string_view>& lines, handler_class handler)
+{
+    std::string_view line;
+    line_splitter splitter(block);
+    lines.clear();
+    while (splitter.next(line)) {
+        lines.push_back(line);
+        if (lines.size() == line_batch_size) {
+            handler(lines.data(), lines.size());
+            lines.clear();
         }
-        counter.append(line);
-		//counter.debug(std::cerr);
+    }
+    if (!lines.empty()) {
+        handler(lines.data(), lines.size());
     }
 }
 
-template <class count_type>
+/**
+ * Passes the batches of lines of the input to a handler in order, on this
+ * thread.
+ *  The lines of a batch are valid until the handler returns.
+ *  @param  reader      The reader of the input.
+ *  @param  pipeline    Whether to read and split the input on separate
+ *                      threads (--pipeline).
+ *  @param  handler     The function receiving an array of lines
+ *                      (const std::string_view*) and its size.
+ */
+template <class handler_class>
+void read_line_batches(line_reader& reader, bool pipeline, handler_class handler)
+{
+    if (pipeline) {
+        line_pipeline(reader).run_batches(handler);
+        return;
+    }
+    std::vector<char> buffer;
+    std::vector<std::string_view> lines;
+    std::string_view block;
+    while (reader.read_block(buffer, block)) {
+        split_line_batches(block, lines, handler);
+    }
+}
+
+template <class counter_type, class = void>
+struct has_append_batch : std::false_type
+{
+};
+
+template <class counter_type>
+struct has_append_batch<counter_type, std::void_t<decltype(
+    std::declval<counter_type&>().append_batch(
+        std::declval<const typename counter_type::key_view*>(), size_t(0)))> >
+    : std::true_type
+{
+};
+
+/// The number of keys parsed at once for append_batch().
+static constexpr size_t key_batch_size = 256;
+
+/**
+ * Counts a batch of lines as keys.
+ *  The keys are passed to append_batch() of the counter if it has one, so
+ *  that it can hash and prefetch them in advance; otherwise, to append().
+ *  @param  counter     The counter.
+ *  @param  lines       The array of lines.
+ *  @param  n           The number of lines.
+ */
+template <class keys, class counter_class>
+void append_lines(counter_class& counter, const std::string_view *lines, size_t n)
+{
+    if constexpr (has_append_batch<counter_class>::value) {
+        typename counter_class::key_view views[key_batch_size];
+        for (size_t offset = 0;offset < n;offset += key_batch_size) {
+            size_t size = std::min(key_batch_size, n - offset);
+            for (size_t i = 0;i < size;++i) {
+                views[i] = keys::parse(lines[offset + i]);
+            }
+            counter.append_batch(views, size);
+        }
+    } else {
+        for (size_t i = 0;i < n;++i) {
+            counter.append(keys::parse(lines[i]));
+        }
+    }
+}
+
+/**
+ * Counts the lines of the input into an exact counter.
+ *  With multiple threads, every thread reads line-aligned blocks of the
+ *  input and counts their lines into its own counter, and the counters are
+ *  merged at the end. The merged counter receives the keys in the order of
+ *  their first occurrences in the input, so that it is identical to (and
+ *  iterates in the same order as) the counter of a single-threaded run.
+ *  @param  counter     The counter.
+ *  @param  reader      The reader of the input.
+ *  @param  num_threads The number of threads.
+ *  @param  pipeline    Whether to pipeline a single-threaded run.
+ *  @param  handler     The function receiving a counter and a line.
+ */
+template <class counter_class, class handler_class>
+void count_exact_data(
+    counter_class& counter,
+    line_reader& reader,
+    int num_threads,
+    bool pipeline,
+    handler_class handler
+    )
+{
+    typedef std::vector<const typename counter_class::key_type*> journal_t;
+
+    if (num_threads <= 1) {
+        read_lines(reader, pipeline, [&](std::string_view line) {
+            handler(counter, line);
+        });
+        return;
+    }
+
+    // The keys inserted into each counter, per block of the input.
+    std::deque<journal_t> journals;
+    std::vector<counter_class> counters(num_threads);
+
+    process_blocks(reader, num_threads, [&](int i) {
+        journals.push_back(journal_t());
+        counters[i].record_insertions(&journals.back());
+    }, [&](int i, std::string_view block) {
+        std::string_view line;
+        line_splitter lines(block);
+        while (lines.next(line)) {
+            handler(counters[i], line);
+        }
+    });
+
+    // Insert the keys in the order of their first occurrences.
+    typename std::deque<journal_t>::const_iterator it;
+    for (it = journals.begin();it != journals.end();++it) {
+        for (size_t j = 0;j < it->size();++j) {
+            counter.insert(typename counter_class::value_type(*(*it)[j], 0));
+        }
+    }
+    for (int i = 0;i < num_threads;++i) {
+        counter.merge(counters[i]);
+    }
+}
+
+/**
+ * Counts the lines of the input into a mergeable summary.
+ *  With multiple threads, every thread counts line-aligned blocks of the
+ *  input into its own summary of the same size, and the summaries are
+ *  merged into the counter at the end.
+ *  @param  counter     The counter.
+ *  @param  reader      The reader of the input.
+ *  @param  num_threads The number of threads.
+ *  @param  pipeline    Whether to pipeline a single-threaded run.
+ *  @param  create      The function returning a new empty summary of the
+ *                      same size as the counter.
+ *  @param  handler     The function receiving a counter, an array of lines
+ *                      and its size.
+ */
+template <class counter_class, class create_class, class handler_class>
+void count_summary_data(
+    counter_class& counter,
+    line_reader& reader,
+    int num_threads,
+    bool pipeline,
+    create_class create,
+    handler_class handler
+    )
+{
+    if (num_threads <= 1) {
+        read_line_batches(reader, pipeline, [&](const std::string_view *lines, size_t n) {
+            handler(counter, lines, n);
+        });
+        return;
+    }
+
+    std::vector<std::unique_ptr<counter_class> > shards;
+    std::vector<std::vector<std::string_view> > buffers(num_threads);
+    for (int i = 0;i < num_threads;++i) {
+        shards.push_back(std::unique_ptr<counter_class>(create()));
+    }
+
+    process_blocks(reader, num_threads, [](int) {
+    }, [&](int i, std::string_view block) {
+        split_line_batches(block, buffers[i], [&](const std::string_view *lines, size_t n) {
+            handler(*shards[i], lines, n);
+        });
+    });
+
+    for (int i = 0;i < num_threads;++i) {
+        counter.merge(*shards[i]);
+    }
+}
+
+/**
+ * Writes the keys and counts of an exact counter.
+ *  With multiple threads, the lines are formatted in parallel.
+ *  @param  counter     The counter.
+ *  @param  threshold   The minimum count of keys to be written.
+ *  @param  num_threads The number of threads.
+ */
+template <class counter_class>
+void write_counts(const counter_class& counter, double threshold, int num_threads)
+{
+    typedef typename counter_class::value_type value_type;
+    output_writer writer(fileno(stdout));
+
+    std::vector<const value_type*> items;
+    for (typename counter_class::const_iterator it = counter.begin();it != counter.end();++it) {
+        if (it->second >= threshold) {
+            if (num_threads <= 1) {
+                writer.put(it->first);
+                writer.put('\t');
+                writer.put(it->second);
+                writer.put('\n');
+            } else {
+                items.push_back(&*it);
+            }
+        }
+    }
+    write_parallel(writer, items.size(), num_threads, [&items](output_writer& out, size_t i) {
+        out.put(items[i]->first);
+        out.put('\t');
+        out.put(items[i]->second);
+        out.put('\n');
+    });
+    writer.flush();
+}
+
+/**
+ * Writes the keys and counts of an exact counter in external memory.
+ *  @param  counter     The counter.
+ *  @param  threshold   The minimum count of keys to be written.
+ */
+template <class key_type, class count_type>
+void write_counts(external_exact<key_type, count_type>& counter, double threshold)
+{
+    output_writer writer(fileno(stdout));
+    counter.for_each([&](const key_type& key, count_type count) {
+        if (count >= threshold) {
+            writer.put(key);
+            writer.put('\t');
+            writer.put(count);
+            writer.put('\n');
+        }
+    });
+    writer.flush();
+}
+
+/**
+ * Writes the items of a summary whose counts are no smaller than a threshold.
+ *  @param  counter     The counter.
+ *  @param  threshold   The minimum count of items to be written.
+ */
+template <class counter_class>
+void write_items(const counter_class& counter, double threshold)
+{
+    output_writer writer(fileno(stdout));
+    counter.items_above(threshold, [&writer](const typename counter_class::item_type& item) {
+        writer.put(item.get_key());
+        writer.put('\t');
+        writer.put(item.get_count());
+        writer.put('\t');
+        writer.put(item.get_epsilon());
+        writer.put('\n');
+    });
+    writer.flush();
+}
+
+/**
+ * The wall-clock times of the phases of a run (--stats).
+ */
+struct phase_times
+{
+    stopwatch watch;
+    double load;        ///< Restoring the state and opening the input.
+    double count;       ///< Reading and counting the input.
+    double output;      ///< Saving the state and writing the results.
+
+    phase_times() : load(0.), count(0.), output(0.)
+    {
+    }
+};
+
+/**
+ * Writes the statistics of a run as JSON to stderr if --stats is specified.
+ *  The time of the count phase is split into the time spent in reading
+ *  the input and the rest.
+ *  @param  opt         The options.
+ *  @param  counter     The counter.
+ *  @param  reader      The reader of the input.
+ *  @param  times       The times of the phases.
+ */
+template <class counter_class>
+void write_stats(const option& opt, const counter_class& counter, const line_reader& reader, const phase_times& times)
+{
+    if (!opt.stats) {
+        return;
+    }
+    double input = reader.read_time();
+    stats_writer writer(std::cerr);
+    writer.add("algorithm", opt.algorithm);
+    writer.add("type", opt.type);
+    writer.add("key_type", opt.key_type);
+    writer.add("threads", opt.threads);
+    writer.add("counter_stats", COUNTER_STATS_ENABLED);
+    writer.add("total", (uint64_t)counter.total());
+    writer.begin("time");
+    writer.add("load", times.load);
+    writer.add("input", input);
+    writer.add("count", std::max(0., times.count - input));
+    writer.add("output", times.output);
+    writer.add("total", times.load + times.count + times.output);
+    writer.end();
+    writer.begin("counter");
+    write_counter_stats(writer, counter);
+    writer.end();
+}
+
+/**
+ * Counts the lines exactly within --memory-limit, spilling the counts to
+ * sorted runs in --temp-dir.
+ *  @param  opt         The options.
+ *  @param  handler     The function receiving a counter and a line.
+ */
+template <class keys, class count_type, class handler_class>
+int count_external(const option& opt, handler_class handler)
+{
+    phase_times times;
+    typedef external_exact<typename keys::key_type, count_type> counter_t;
+    if (1 < opt.threads) {
+        throw std::runtime_error("--memory-limit is not supported with --threads");
+    }
+    counter_t counter((size_t)opt.memory_limit, opt.temp_dir);
+    load_state(counter, opt);
+    line_reader reader(fileno(stdin));
+    times.load = times.watch.lap();
+    read_lines(reader, opt.pipeline, [&](std::string_view line) {
+        handler(counter, line);
+    });
+    times.count = times.watch.lap();
+    save_state(counter, opt);
+
+    double threshold = opt.absolute_support ? opt.support : opt.support * counter.total();
+    write_counts(counter, threshold);
+    times.output = times.watch.lap();
+    write_stats(opt, counter, reader, times);
+    return 0;
+}
+
+template <class keys, class count_type>
 int count_exact(const option& opt)
 {
-    typedef exact<std::string, count_type> counter_t;
+    if (0 < opt.memory_limit) {
+        return count_external<keys, count_type>(opt, [](auto& c, std::string_view line) {
+            c.append(keys::parse(line));
+        });
+    }
+
+    phase_times times;
+    typedef exact<typename keys::key_type, count_type> counter_t;
     counter_t counter;
-    count_data(counter, std::cin);
+    load_state(counter, opt);
+    line_reader reader(fileno(stdin));
+    times.load = times.watch.lap();
+    count_exact_data(counter, reader, opt.threads, opt.pipeline, [](counter_t& c, std::string_view line) {
+        c.append(keys::parse(line));
+    });
+    times.count = times.watch.lap();
+    save_state(counter, opt);
 	
     double threshold = opt.absolute_support ? opt.support : opt.support * counter.total();
-    for (typename counter_t::const_iterator it = counter.begin();it != counter.end();++it) {
-        if (it->second  >= threshold) {
-            std::cout << it->first << '\t' << it->second << std::endl;
-        }
-    }
-	
+    write_counts(counter, threshold, opt.threads);
+    times.output = times.watch.lap();
+    write_stats(opt, counter, reader, times);
     return 0;
 }
 
 
+/**
+ * Extracts the token and the frequency of a line for the sum algorithms.
+ *  @param  line        The line.
+ *  @param  opt         The options specifying the fields.
+ *  @param  token       The token.
+ *  @param  freq        The frequency.
+ *  @throws             std::runtime_error if the frequency is not a valid
+ *                      number of count_type.
+ */
 template <class count_type>
-int count_spacesaving(const option& opt)
+void parse_sum_line(std::string_view line, const option& opt, std::string_view& token, count_type& freq)
 {
-    typedef spacesaving<std::string, count_type> counter_t;
-    typename counter_t::item_type *item = NULL;
-    counter_t counter(opt.epsilon);
-    count_data(counter, std::cin);
-    double threshold = opt.absolute_support ? opt.support : opt.support * counter.total();
-    for (item = counter.top();item != counter.back();item = counter.next(item)) {
-        std::cout <<
-		item->get_key() << '\t' <<
-		item->get_count() << '\t' <<
-		item->get_epsilon() << std::endl;
+    std::string_view field;
+    field_tokenizer fields(line, '\t');
+    if (opt.token_field <= opt.freq_field) {
+        fields.get(opt.token_field, token);
+    }
+    if (fields.get(opt.freq_field, field)) {
+        // Accept a frequency at the end of a CRLF line.
+        if (!field.empty() && field.back() == '\r') {
+            field.remove_suffix(1);
+        }
+        if (!parse_count(field, freq)) {
+            throw std::runtime_error("invalid frequency in line: " + std::string(line));
+        }
+    }
+    if (opt.freq_field < opt.token_field) {
+        fields.get(opt.token_field, token);
     }
-    return 0;
 }
 
+template <class counter_type, class = void>
+struct has_append_sum_batch : std::false_type
+{
+};
+
+template <class counter_type>
+struct has_append_sum_batch<counter_type, std::void_t<decltype(
+    std::declval<counter_type&>().append_batch(
+        std::declval<const typename counter_type::key_view*>(), size_t(0),
+        std::declval<const typename counter_type::count_type*>()))> >
+    : std::true_type
+{
+};
+
+/**
+ * Counts a batch of lines of (--sum) tokens and frequencies.
+ *  @param  counter     The counter.
+ *  @param  lines       The array of lines.
+ *  @param  n           The number of lines.
+ *  @param  opt         The options.
+ */
+template <class keys, class counter_class>
+void append_sum_lines(counter_class& counter, const std::string_view *lines, size_t n, const option& opt)
+{
+    typedef typename counter_class::count_type count_type;
+    if constexpr (has_append_sum_batch<counter_class>::value) {
+        typename counter_class::key_view views[key_batch_size];
+        count_type freqs[key_batch_size];
+        for (size_t offset = 0;offset < n;offset += key_batch_size) {
+            size_t size = std::min(key_batch_size, n - offset);
+            for (size_t i = 0;i < size;++i) {
+                std::string_view token;
+                freqs[i] = 0;
+                parse_sum_line(lines[offset + i], opt, token, freqs[i]);
+                views[i] = keys::parse(token);
+            }
+            counter.append_batch(views, size, freqs);
+        }
+    } else {
+        for (size_t i = 0;i < n;++i) {
+            std::string_view token;
+            count_type freq = 0;
+            parse_sum_line(lines[i], opt, token, freq);
+            counter.append(keys::parse(token), freq);
+        }
+    }
+}
+
+/**
+ * Counts the lines, or the (--sum) frequencies of tokens, with a summary.
+ *  @param  opt         The options.
+ *  @param  args        The arguments for constructing a summary.
+ */
+template <class keys, class counter_class, bool sum, class... arg_types>
+int count_lines_with(const option& opt, arg_types... args)
+{
+    phase_times times;
+    counter_class counter(args...);
+    load_state(counter, opt);
+    line_reader reader(fileno(stdin));
+    times.load = times.watch.lap();
+    count_summary_data(counter, reader, opt.threads, opt.pipeline, [=]() {
+        return new counter_class(args...);
+    }, [&opt](counter_class& c, const std::string_view *lines, size_t n) {
+        if constexpr (sum) {
+            append_sum_lines<keys>(c, lines, n, opt);
+        } else {
+            append_lines<keys>(c, lines, n);
+        }
+    });
+    times.count = times.watch.lap();
+    save_state(counter, opt);
+    double threshold = opt.absolute_support ? opt.support : opt.support * counter.total();
+    write_items(counter, threshold);
+    times.output = times.watch.lap();
+    write_stats(opt, counter, reader, times);
     return 0;
 }
 
-template <class count_type>
+/**
+ * Counts the lines with a summary, behind a front cache of --front-cache
+ * entries if specified.
+ *  @param  opt         The options.
+ *  @param  args        The arguments for constructing a summary.
+ */
+template <class keys, class counter_class, bool sum, class... arg_types>
+int count_with_summary(const option& opt, arg_types... args)
+{
+    if (0 < opt.front_cache) {
+        if constexpr (has_weighted_append<counter_class>::value) {
+            return count_lines_with<keys, front_cache<counter_class>, sum>(opt, (size_t)opt.front_cache, args...);
+        } else {
+            throw std::runtime_error("--front-cache is not supported by " + opt.algorithm);
+        }
+    }
+    return count_lines_with<keys, counter_class, sum>(opt, args...);
+}
+
+/**
+ * Counts the lines with a summary of --epsilon counters (spacesaving,
+ * misragries, lossycounting).
+ */
+template <class keys, template <class, class> class summary_tmpl, class count_type>
+int count_summary(const option& opt)
+{
+    typedef typename keys::template summary<summary_tmpl<typename keys::key_type, count_type> >::type counter_t;
+    return count_with_summary<keys, counter_t, false>(opt, opt.epsilon);
+}
+
+template <class keys, class count_type>
 int do_sum(const option& opt)
 {
-    typedef std::unordered_map<std::string, count_type> counter_t;
+    if (0 < opt.memory_limit) {
+        return count_external<keys, count_type>(opt, [&opt](auto& c, std::string_view line) {
+            std::string_view token;
+            count_type freq = 0;
+            parse_sum_line(line, opt, token, freq);
+            c.append(keys::parse(token), freq);
+        });
+    }
+
+    phase_times times;
+    typedef exact<typename keys::key_type, count_type> counter_t;
     counter_t counter;
-    count_type n = 0;
-	
-    for (;;) {
-        std::string line;
-        std::getline(std::cin, line);
-        if (std::cin.eof()) {
-            break;
-        }
-		
-        std::string token;
-        int k = 1, freq = 0;
-        tokenizer fields(line, '\t');
-        for (tokenizer::iterator it = fields.begin();it != fields.end();++it) {
-            if (k == opt.token_field) {
-                token = *it;
-            }
-            if (k == opt.freq_field) {
-                freq = std::atoi(it->c_str());
-            }
-            ++k;
+    load_state(counter, opt);
+    line_reader reader(fileno(stdin));
+    times.load = times.watch.lap();
+	
+    count_exact_data(counter, reader, opt.threads, opt.pipeline, [&opt](counter_t& c, std::string_view line) {
+        std::string_view token;
+        count_type freq = 0;
+        parse_sum_line(line, opt, token, freq);
+        c.append(keys::parse(token), freq);
+    });
+    times.count = times.watch.lap();
+    save_state(counter, opt);
+	
+    double threshold = opt.absolute_support ? opt.support : opt.support * counter.total();
+    write_counts(counter, threshold, opt.threads);
+    times.output = times.watch.lap();
+    write_stats(opt, counter, reader, times);
+    return 0;
+}
+
+/**
+ * Counts the (--sum) frequencies of tokens with a summary of --epsilon
+ * counters (spacesaving-sum, spacesaving-heap-sum).
+ */
+template <class keys, template <class, class> class summary_tmpl, class count_type>
+int count_summary_sum(const option& opt)
+{
+    typedef typename keys::template summary<summary_tmpl<typename keys::key_type, count_type> >::type counter_t;
+    return count_with_summary<keys, counter_t, true>(opt, opt.epsilon);
+}
+
+/**
+ * Counts the lines with a Count-Min sketch.
+ *  The sketch keeps --top-k heavy hitters (the value of --epsilon by
+ *  default), which are written with their estimated counts and the bound
+ *  of the overestimation.
+ */
+template <class keys, class count_type>
+int count_countmin(const option& opt)
+{
+    typedef typename keys::template summary<countmin<typename keys::key_type, count_type> >::type counter_t;
+    size_t k = (0 < opt.top_k) ? opt.top_k : opt.epsilon;
+    return count_with_summary<keys, counter_t, false>(opt, opt.epsilon, opt.delta, k);
+}
+
+/**
+ * Counts the lines of the input one after another.
+ *  @param  counter     The counter.
+ *  @param  opt         The options.
+ *  @param  times       The times of the phases (started by the caller).
+ */
+template <class keys, class counter_class>
+int count_lines(counter_class& counter, const option& opt, phase_times& times)
+{
+    load_state(counter, opt);
+    line_reader reader(fileno(stdin));
+    times.load = times.watch.lap();
+    read_line_batches(reader, opt.pipeline, [&counter](const std::string_view *lines, size_t n) {
+        append_lines<keys>(counter, lines, n);
+    });
+    times.count = times.watch.lap();
+    save_state(counter, opt);
+    double threshold = opt.absolute_support ? opt.support : opt.support * counter.total();
+    write_items(counter, threshold);
+    times.output = times.watch.lap();
+    write_stats(opt, counter, reader, times);
+    return 0;
+}
+
+/**
+ * Counts the latest --window lines, or the counts decayed by --decay.
+ *  The lines are counted in the order of the input, with one thread.
+ */
+template <class keys, class count_type>
+int count_windowed(const option& opt)
+{
+    typedef typename keys::key_type key_type;
+    phase_times times;
+
+    if constexpr (std::is_same<keys, fingerprint_keys>::value) {
+        std::cerr << "ERROR: unsupported key type for --window or --decay: " << opt.key_type << std::endl;
+        return 1;
+    } else {
+        if (1 < opt.threads) {
+            std::cerr << "ERROR: --window and --decay count with one thread" << std::endl;
+            return 1;
+        } else if (0 < opt.window && opt.decay != 0.) {
+            std::cerr << "ERROR: --window and --decay are exclusive" << std::endl;
+            return 1;
         }
-        
-        typename counter_t::iterator it = counter.find(token);
-        if (it != counter.end()) {
-            it->second += freq;
-        } else {
-            counter.insert(typename counter_t::value_type(token, freq));
+
+        if (opt.decay != 0.) {
+            if (opt.algorithm == "spacesaving") {
+                decayed<key_type> counter(opt.epsilon, opt.decay);
+                return count_lines<keys>(counter, opt, times);
+            }
+        } else if (opt.algorithm == "spacesaving") {
+            windowed<spacesaving<key_type, count_type> > counter(opt.window, opt.window_epochs, opt.epsilon);
+            return count_lines<keys>(counter, opt, times);
+        } else if (opt.algorithm == "misragries") {
+            windowed<misragries<key_type, count_type> > counter(opt.window, opt.window_epochs, opt.epsilon);
+            return count_lines<keys>(counter, opt, times);
+        } else if (opt.algorithm == "lossycounting") {
+            windowed<lossycounting<key_type, count_type> > counter(opt.window, opt.window_epochs, opt.epsilon);
+            return count_lines<keys>(counter, opt, times);
         }
-		
-        n += freq;
+        std::cerr << "ERROR: unsupported algorithm for --window or --decay: " << opt.algorithm << std::endl;
+        return 1;
     }
-	
-    double threshold = opt.absolute_support ? opt.support : opt.support * n;
-    typename counter_t::const_iterator it;
-    for (it = counter.begin();it != counter.end();++it) {
-        if (it->second  >= threshold) {
-            std::cout << it->first << '\t' << it->second << std::endl;
+}
+
+template <class keys, class count_type>
+int count(const option& opt)
+{
+    if (0 < opt.front_cache && !opt.approximate_cache) {
+        std::cerr << "ERROR: --front-cache may change the reported counts; specify --approximate-cache to accept this" << std::endl;
+        return 1;
+    }
+    if (0 < opt.front_cache && (0 < opt.window || opt.decay != 0.)) {
+        std::cerr << "ERROR: --front-cache is not supported with --window or --decay" << std::endl;
+        return 1;
+    }
+    if ((!opt.save_state.empty() || !opt.load_state.empty()) && (0 < opt.window || opt.decay != 0.)) {
+        std::cerr << "ERROR: snapshots are not supported with --window or --decay" << std::endl;
+        return 1;
+    }
+    if (0 < opt.memory_limit && opt.algorithm != "exact" && opt.algorithm != "sum") {
+        std::cerr << "ERROR: --memory-limit is supported only by exact and sum" << std::endl;
+        return 1;
+    }
+    if (0 < opt.memory_limit && opt.memory_limit < external_exact<std::string>::min_memory_limit) {
+        std::cerr << "ERROR: --memory-limit must be at least " << (external_exact<std::string>::min_memory_limit >> 20) << "M" << std::endl;
+        return 1;
+    }
+    if (0 < opt.window || opt.decay != 0.) {
+        return count_windowed<keys, count_type>(opt);
+    }
+
+    // Exact counters of fingerprints would keep every string anyway.
+    const bool exact_keys = !std::is_same<keys, fingerprint_keys>::value;
+
+    if constexpr (exact_keys) {
+        if (0 < opt.front_cache && (opt.algorithm == "exact" || opt.algorithm == "sum")) {
+            // The cache would change the order of the keys in the output.
+            std::cerr << "ERROR: --front-cache is not supported by " << opt.algorithm << std::endl;
+            return 1;
+        } else if (opt.algorithm == "exact") {
+            return count_exact<keys, count_type>(opt);
+        } else if (opt.algorithm == "sum") {
+            return do_sum<keys, count_type>(opt);
         }
     }
-    return 0;
+    if (opt.algorithm == "spacesaving") {
+        return count_summary<keys, spacesaving, count_type>(opt);
+    } else if (opt.algorithm == "misragries") {
+        return count_summary<keys, misragries, count_type>(opt);
+    } else if (opt.algorithm == "lossycounting") {
+        return count_summary<keys, lossycounting, count_type>(opt);
+    } else if (opt.algorithm == "spacesaving-sum") {
+        return count_summary_sum<keys, spacesaving, count_type>(opt);
+    } else if (opt.algorithm == "spacesaving-heap-sum") {
+        return count_summary_sum<keys, spacesaving_PriorityQ, count_type>(opt);
+    } else if (opt.algorithm == "countmin") {
+        return count_countmin<keys, count_type>(opt);
+    } else if (opt.algorithm == "exact" || opt.algorithm == "sum") {
+        std::cerr << "ERROR: unsupported key type for " << opt.algorithm << ": " << opt.key_type << std::endl;
+        return 1;
+    } else {
+        std::cerr << "ERROR: unrecognized algorithm: " << opt.algorithm << std::endl;
+        return 1;
+    }
 }
 
 template <class count_type>
 int count(const option& opt)
 {
-    if (opt.algorithm == "exact") {
-        return count_exact<count_type>(opt);
-    } else if (opt.algorithm == "sum") {
-        return do_sum<count_type>(opt);
-    } else if (opt.algorithm == "spacesaving") {
-        return count_spacesaving<count_type>(opt);
+    if (opt.key_type == "string") {
+        return count<string_keys, count_type>(opt);
+    } else if (opt.key_type == "uint32") {
+        return count<integer_keys<uint32_t>, count_type>(opt);
+    } else if (opt.key_type == "uint64") {
+        return count<integer_keys<uint64_t>, count_type>(opt);
+    } else if (opt.key_type == "hash64") {
+        return count<fingerprint_keys, count_type>(opt);
     } else {
-        std::cerr << "ERROR: unrecognized algorithm: " << opt.algorithm << std::endl;
+        std::cerr << "ERROR: unrecognized key type: " << opt.key_type << std::endl;
         return 1;
     }
 }
@@ -190,15 +1120,25 @@ int main(int argc, char *argv[])
         std::cerr << "ERROR: " << e.what() << std::endl;
         return 1;
     }
+
+    if (opt.help) {
+        usage(std::cout, argv[0]);
+        return 0;
+    }
 	
-    if (opt.type == "uint16") {
-        return count<uint16_t>(opt);
-    } else if (opt.type == "uint32") {
-        return count<uint32_t>(opt);
-    } else if (opt.type == "uint64") {
-        return count<uint64_t>(opt);
-    } else {
-        std::cerr << "ERROR: unrecognized type: " << opt.type << std::endl;
+    try {
+        if (opt.type == "uint16") {
+            return count<uint16_t>(opt);
+        } else if (opt.type == "uint32") {
+            return count<uint32_t>(opt);
+        } else if (opt.type == "uint64") {
+            return count<uint64_t>(opt);
+        } else {
+            std::cerr << "ERROR: unrecognized type: " << opt.type << std::endl;
+            return 1;
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
         return 1;
     }
 	
@@ -0,0 +1,399 @@
+/*
+ *      Misra-Gries algorithm.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MISRAGRIES_H__
+#define __MISRAGRIES_H__
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "snapshot.h"
+
+/**
+ * Misra-Gries algorithm (frequent items) with batched decrements.
+ *  The summary holds up to 2m counters. When a new key arrives at a full
+ *  table, all counters are decremented at once by their median, which
+ *  removes at least half of the counters; the next decrement is thus at
+ *  least m new keys away, and the cost of a decrement is amortized to
+ *  O(1) per update. A decrement does not touch the counters: every item
+ *  stores its count plus the total amount of decrements (offset), so that
+ *  a decrement only raises the offset and removes the items whose stored
+ *  values do not exceed it.
+ *
+ *  As a result, the stored value of an item is an upper bound of the true
+ *  count, like the count of Space-Saving, and the offset at the insertion
+ *  of the item (epsilon) bounds the overestimation. A key without a
+ *  counter occurred at most offset times.
+ *  @param  key_tmpl        Key type.
+ *  @param  count_tmpl      Count type.
+ */
+template <class key_tmpl, class count_tmpl=int>
+class misragries
+{
+public:
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// Count type.
+    typedef count_tmpl count_type;
+    /// This class.
+    typedef misragries<key_tmpl, count_tmpl> this_type;
+    /// The type for looking up a key (e.g., std::string_view for strings).
+    typedef typename key_traits<key_tmpl>::view_type key_view;
+
+    /**
+     * A count item.
+     */
+    class item_type
+    {
+        friend class misragries<key_tmpl, count_tmpl>;
+
+    protected:
+        key_type key;       ///< The key.
+        uint32_t hash;      ///< The hash value of the key.
+        mutable uint32_t rank;  ///< The position in the order of iteration.
+        count_type count;   ///< The count plus the offset (upper bound).
+        count_type eps;     ///< The offset at the insertion (overestimation).
+
+    public:
+        item_type() : hash(0), rank(0), count(0), eps(0)
+        {
+        }
+
+        const key_type& get_key() const
+        {
+            return this->key;
+        }
+
+        count_type get_count() const
+        {
+            return this->count;
+        }
+
+        count_type get_epsilon() const
+        {
+            return this->eps;
+        }
+    };
+
+protected:
+    /// Key hashing.
+    typedef key_traits<key_type> traits_t;
+    /// The mapping object: key -> position of the item in the pool.
+    keyindex m_keys;
+    /// The total frequency.
+    count_type m_n;
+    /// The number of counters kept after a decrement.
+    count_type m_m;
+    /// The total amount of decrements.
+    count_type m_offset;
+    /// The pool of items (up to 2m items).
+    std::vector<item_type> m_items;
+    /// The positions of items in the order of iteration (and a scratch).
+    mutable std::vector<uint32_t> m_order;
+    /// The scratch space for finding the median.
+    std::vector<count_type> m_counts;
+
+public:
+    /**
+     * Constructs an object.
+     *  @param  m       The number of counters (2m counters are allocated).
+     */
+    misragries(count_type m=4)
+        : m_keys(2 * (size_t)m), m_n(0), m_m(m), m_offset(0)
+    {
+        m_items.reserve(2 * (size_t)m);
+        m_order.reserve(2 * (size_t)m);
+        m_counts.reserve(2 * (size_t)m);
+    }
+
+    virtual ~misragries()
+    {
+    }
+
+    /**
+     * Counts an occurrence of a key.
+     *  @param  key     The key.
+     *  @return bool    \c true if a counter was assigned to the key.
+     */
+    bool append(const key_view& key)
+    {
+        uint32_t hash = traits_t::hash(key);
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        ++m_n;
+        if (i != keyindex::npos) {
+            ++m_items[i].count;
+            return false;
+        }
+        if (m_items.size() == 2 * (size_t)m_m) {
+            decrement();
+        }
+        push_item(key, hash, m_offset + 1, m_offset);
+        return true;
+    }
+
+    /**
+     * Merges another summary into this summary.
+     *  A key missing in a summary is regarded to have the offset of the
+     *  summary as its count and epsilon; the counts, epsilons and offsets
+     *  are added, and the table is decremented if it overflows.
+     *  @param  other   The summary to be merged into this summary.
+     */
+    void merge(const misragries& other)
+    {
+        std::vector<item_type> items;
+        items.reserve(m_items.size() + other.m_items.size());
+        for (size_t i = 0;i < m_items.size();++i) {
+            item_type item = m_items[i];
+            const item_type *x = other.find(item.key, item.hash);
+            item.count += (x != NULL) ? x->count : other.m_offset;
+            item.eps += (x != NULL) ? x->eps : other.m_offset;
+            items.push_back(item);
+        }
+        for (size_t i = 0;i < other.m_items.size();++i) {
+            const item_type& x = other.m_items[i];
+            if (this->find(x.key, x.hash) == NULL) {
+                item_type item = x;
+                item.count += m_offset;
+                item.eps += m_offset;
+                items.push_back(item);
+            }
+        }
+
+        m_n += other.m_n;
+        m_offset += other.m_offset;
+        m_items.clear();
+        for (size_t i = 0;i < items.size();++i) {
+            if (m_offset < items[i].count) {
+                m_items.push_back(items[i]);
+            }
+        }
+        while (2 * (size_t)m_m < m_items.size()) {
+            decrement();
+        }
+        reindex();
+    }
+
+    /**
+     * Gets the item with the largest count.
+     *  The order of iteration is computed by this function, and it is
+     *  valid until the summary is updated.
+     *  @return item_type*  The item, or NULL if the summary is empty.
+     */
+    item_type *top()
+    {
+        sort_items();
+        return m_order.empty() ? NULL : &m_items[m_order[0]];
+    }
+
+    /**
+     * Gets the item following an item in the order of iteration.
+     *  @return item_type*  The item, or NULL at the end.
+     */
+    item_type *next(item_type *cur)
+    {
+        size_t r = cur->rank + 1;
+        return (r < m_order.size()) ? &m_items[m_order[r]] : NULL;
+    }
+
+    /**
+     * Visits the items whose counts are no smaller than a threshold, in
+     * the descending order of their counts.
+     *  @param  threshold   The minimum count of items to visit.
+     *  @param  visit       The function receiving an item (const item_type&).
+     *  @return size_t      The number of visited items.
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        sort_items();
+        size_t n = 0;
+        for (;n < m_order.size() && threshold <= m_items[m_order[n]].count;++n) {
+            visit(m_items[m_order[n]]);
+        }
+        return n;
+    }
+
+    /**
+     * Saves the summary to a snapshot file.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void save(const std::string& path) const
+    {
+        size_t n = m_items.size();
+        std::vector<count_type> counts(n), eps(n);
+        std::vector<uint32_t> hashes(n);
+        for (size_t i = 0;i < n;++i) {
+            counts[i] = m_items[i].count;
+            eps[i] = m_items[i].eps;
+            hashes[i] = m_items[i].hash;
+        }
+
+        snapshot_writer writer(path, SNAPSHOT_MISRAGRIES, snapshot_key<key_type>::size, sizeof(count_type));
+        writer.put(m_n);
+        writer.put(m_m);
+        writer.put(m_offset);
+        writer.put(n);
+        writer.put_array(counts.data(), n);
+        writer.put_array(eps.data(), n);
+        writer.put_array(hashes.data(), n);
+        snapshot_put_keys<key_type>(writer, m_items.begin(), n, [](const item_type& item) -> const key_type& {
+            return item.key;
+        });
+        writer.close();
+    }
+
+    /**
+     * Loads the summary from a snapshot file.
+     *  This replaces the current state, including the number of counters.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void load(const std::string& path)
+    {
+        snapshot_reader reader(path, SNAPSHOT_MISRAGRIES, snapshot_key<key_type>::size, sizeof(count_type));
+        count_type total = (count_type)reader.get();
+        count_type m = (count_type)reader.get();
+        count_type offset = (count_type)reader.get();
+        size_t n = (size_t)reader.get();
+        if (m < 1 || 2 * (size_t)m < n) {
+            reader.fail();
+        }
+        const count_type *counts = reader.get_array<count_type>(n);
+        const count_type *eps = reader.get_array<count_type>(n);
+        const uint32_t *hashes = reader.get_array<uint32_t>(n);
+
+        if (m != m_m) {
+            m_m = m;
+            m_keys = keyindex(2 * (size_t)m);
+            m_items.reserve(2 * (size_t)m);
+            m_order.reserve(2 * (size_t)m);
+            m_counts.reserve(2 * (size_t)m);
+        }
+        m_items.assign(n, item_type());
+        for (size_t i = 0;i < n;++i) {
+            if (counts[i] <= offset) {
+                reader.fail();
+            }
+            m_items[i].count = counts[i];
+            m_items[i].eps = eps[i];
+            m_items[i].hash = hashes[i];
+        }
+        snapshot_get_keys(reader, n, [&](size_t i, std::string_view bytes) {
+            return snapshot_key<key_type>::assign(m_items[i].key, bytes);
+        });
+        m_n = total;
+        m_offset = offset;
+        reindex();
+    }
+
+    count_type total() const
+    {
+        return m_n;
+    }
+
+protected:
+    const item_type *find(const key_view& key, uint32_t hash) const
+    {
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        return (i != keyindex::npos) ? &m_items[i] : NULL;
+    }
+
+    void push_item(const key_view& key, uint32_t hash, count_type count, count_type eps)
+    {
+        uint32_t i = (uint32_t)m_items.size();
+        m_items.push_back(item_type());
+        item_type& item = m_items.back();
+        item.key = key;
+        item.hash = hash;
+        item.count = count;
+        item.eps = eps;
+        m_keys.insert(hash, i);
+    }
+
+    /**
+     * Decrements all counters by their median.
+     */
+    void decrement()
+    {
+        // The median of the stored values becomes the offset, so that the
+        // counters of at least half of the items become zero.
+        m_counts.clear();
+        for (size_t i = 0;i < m_items.size();++i) {
+            m_counts.push_back(m_items[i].count);
+        }
+        std::nth_element(m_counts.begin(), m_counts.begin() + m_counts.size() / 2, m_counts.end());
+        m_offset = std::max(m_offset, m_counts[m_counts.size() / 2]);
+
+        // Remove the items whose counters became zero.
+        size_t n = 0;
+        for (size_t i = 0;i < m_items.size();++i) {
+            if (m_offset < m_items[i].count) {
+                if (n != i) {
+                    m_items[n] = std::move(m_items[i]);
+                }
+                ++n;
+            }
+        }
+        m_items.resize(n);
+        reindex();
+    }
+
+    void reindex()
+    {
+        m_keys.clear();
+        for (size_t i = 0;i < m_items.size();++i) {
+            m_keys.insert(m_items[i].hash, (uint32_t)i);
+        }
+    }
+
+    void sort_items() const
+    {
+        m_order.resize(m_items.size());
+        for (size_t i = 0;i < m_items.size();++i) {
+            m_order[i] = (uint32_t)i;
+        }
+        std::sort(m_order.begin(), m_order.end(), [this](uint32_t i, uint32_t j) {
+            return m_items[j].count < m_items[i].count || (m_items[j].count == m_items[i].count && i < j);
+        });
+        for (size_t r = 0;r < m_order.size();++r) {
+            m_items[m_order[r]].rank = (uint32_t)r;
+        }
+    }
+};
+
+#endif/*__MISRAGRIES_H__*/
@@ -0,0 +1,406 @@
+/*
+ *      Pipelined reading and splitting of input lines.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "reader.h"
+
+/**
+ * A bounded lock-free queue for one producer thread and one consumer thread.
+ *  @param  value_tmpl      The type of elements.
+ */
+template <class value_tmpl>
+class spsc_ring
+{
+public:
+    typedef value_tmpl value_type;
+
+protected:
+    /// The slots of the elements.
+    std::vector<value_type> m_slots;
+    /// The mask for computing a slot position from a sequence number.
+    size_t m_mask;
+    /// The sequence number of the next element to be popped (by the consumer).
+    alignas(64) std::atomic<size_t> m_head;
+    /// The sequence number of the next element to be pushed (by the producer).
+    alignas(64) std::atomic<size_t> m_tail;
+
+public:
+    /**
+     * Constructs a queue.
+     *  @param  capacity    The minimum number of elements in the queue.
+     */
+    spsc_ring(size_t capacity) : m_head(0), m_tail(0)
+    {
+        size_t n = 2;
+        while (n < capacity) {
+            n *= 2;
+        }
+        m_slots.resize(n);
+        m_mask = n - 1;
+    }
+
+    /**
+     * Pushes an element unless the queue is full (called by the producer).
+     *  @param  value   The element.
+     *  @return bool    \c true if the element was pushed.
+     */
+    bool try_push(const value_type& value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_slots.size()) {
+            return false;
+        }
+        m_slots[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pops an element unless the queue is empty (called by the consumer).
+     *  @param  value   The element.
+     *  @return bool    \c true if an element was popped.
+     */
+    bool try_pop(value_type& value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+/**
+ * A three-stage pipeline handing the lines of an input to a handler.
+ *  An I/O thread reads line-aligned blocks of the input into a pool of
+ *  buffers, a parser thread splits the blocks into batches of lines, and
+ *  the calling thread passes the lines to the handler in the order of the
+ *  input. The stages exchange the positions of buffers and batches through
+ *  single-producer single-consumer rings, and the buffers and batches are
+ *  returned to their producers through rings as well, so that the sizes of
+ *  the pools bound the memory and throttle the producers (back-pressure).
+ *  A stage waiting for a full or empty ring polls it a few times, and then
+ *  sleeps until another stage pushes or pops an element.
+ */
+class line_pipeline
+{
+protected:
+    /// The position representing no buffer.
+    static const uint32_t nil = 0xFFFFFFFF;
+
+    /// A block of lines in a buffer.
+    struct block_t
+    {
+        uint32_t buffer;        ///< The buffer (nil at the end of input).
+        std::string_view data;  ///< The block.
+    };
+
+    /// A batch of lines.
+    struct batch_t
+    {
+        std::vector<std::string_view> lines;    ///< The lines.
+        uint32_t release;       ///< The buffer to be released after the lines.
+        bool end;               ///< Whether this is the end of input.
+    };
+
+    /// The reader of the input.
+    line_reader& m_reader;
+    /// The maximum number of lines in a batch.
+    size_t m_batch_size;
+    /// The pool of buffers.
+    std::vector<std::vector<char> > m_buffers;
+    /// The pool of batches.
+    std::vector<batch_t> m_batches;
+    /// Blocks: I/O thread -> parser thread.
+    spsc_ring<block_t> m_blocks;
+    /// Batches of lines: parser thread -> calling thread.
+    spsc_ring<uint32_t> m_full_batches;
+    /// Unused buffers: calling thread -> I/O thread.
+    spsc_ring<uint32_t> m_free_buffers;
+    /// Unused batches: calling thread -> parser thread.
+    spsc_ring<uint32_t> m_free_batches;
+    /// Whether a stage failed and the pipeline must stop.
+    std::atomic<bool> m_stop;
+    /// The exception thrown by a stage.
+    std::exception_ptr m_error;
+    /// The mutex for m_error.
+    std::mutex m_mutex;
+    /// The mutex for sleeping stages.
+    std::mutex m_wait_mutex;
+    /// The condition for waking sleeping stages.
+    std::condition_variable m_wakeup;
+    /// The number of sleeping (or falling asleep) stages.
+    std::atomic<int> m_waiters;
+
+    /// The number of polls of a ring before a waiting stage sleeps.
+    static const int spin_limit = 64;
+
+public:
+    /**
+     * Constructs a pipeline.
+     *  @param  reader      The reader of the input.
+     *  @param  num_buffers The number of buffers for blocks.
+     *  @param  num_batches The number of batches of lines.
+     *  @param  batch_size  The maximum number of lines in a batch.
+     */
+    line_pipeline(line_reader& reader, size_t num_buffers=4, size_t num_batches=16, size_t batch_size=4096)
+        : m_reader(reader), m_batch_size(batch_size), m_buffers(num_buffers), m_batches(num_batches),
+        m_blocks(num_buffers + 1), m_full_batches(num_batches), m_free_buffers(num_buffers),
+        m_free_batches(num_batches), m_stop(false), m_waiters(0)
+    {
+        for (size_t i = 0;i < num_buffers;++i) {
+            m_free_buffers.try_push((uint32_t)i);
+        }
+        for (size_t i = 0;i < num_batches;++i) {
+            m_batches[i].lines.reserve(batch_size);
+            m_free_batches.try_push((uint32_t)i);
+        }
+    }
+
+    virtual ~line_pipeline()
+    {
+    }
+
+    /**
+     * Passes the lines of the input to a handler.
+     *  @param  handler     The function receiving a line (std::string_view),
+     *                      called on the calling thread.
+     *  @throws             The exception thrown by a stage or the handler.
+     */
+    template <class handler_class>
+    void run(handler_class handler)
+    {
+        run_batches([&](const std::string_view *lines, size_t n) {
+            for (size_t i = 0;i < n;++i) {
+                handler(lines[i]);
+            }
+        });
+    }
+
+    /**
+     * Passes the batches of lines of the input to a handler.
+     *  @param  handler     The function receiving an array of lines
+     *                      (const std::string_view*) and its size, called
+     *                      on the calling thread.
+     *  @throws             The exception thrown by a stage or the handler.
+     */
+    template <class handler_class>
+    void run_batches(handler_class handler)
+    {
+        std::thread io(&line_pipeline::guard, this, &line_pipeline::read_stage);
+        std::thread parser(&line_pipeline::guard, this, &line_pipeline::parse_stage);
+
+        try {
+            uint32_t k;
+            while (pop(m_full_batches, k)) {
+                batch_t& batch = m_batches[k];
+                if (!batch.lines.empty()) {
+                    handler(batch.lines.data(), batch.lines.size());
+                }
+                bool end = batch.end;
+                if (batch.release != nil) {
+                    push(m_free_buffers, batch.release);
+                }
+                push(m_free_batches, k);
+                if (end) {
+                    break;
+                }
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+
+        io.join();
+        parser.join();
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+protected:
+    void read_stage()
+    {
+        uint32_t b;
+        while (pop(m_free_buffers, b)) {
+            block_t block;
+            block.buffer = b;
+            if (!m_reader.read_block(m_buffers[b], block.data)) {
+                block.buffer = nil;
+                push(m_blocks, block);
+                return;
+            }
+            // Touch every page, so that the pages of a memory-mapped input
+            // are read on this thread instead of the parser thread.
+            volatile char sink = 0;
+            for (size_t i = 0;i < block.data.size();i += 4096) {
+                sink = sink + block.data[i];
+            }
+            if (!push(m_blocks, block)) {
+                return;
+            }
+        }
+    }
+
+    void parse_stage()
+    {
+        block_t block;
+        while (pop(m_blocks, block)) {
+            uint32_t k;
+            if (!pop(m_free_batches, k)) {
+                return;
+            }
+            m_batches[k].lines.clear();
+            m_batches[k].release = nil;
+            m_batches[k].end = (block.buffer == nil);
+
+            std::string_view line;
+            line_splitter lines(block.data);
+            while (lines.next(line)) {
+                if (m_batches[k].lines.size() == m_batch_size) {
+                    if (!push(m_full_batches, k) || !pop(m_free_batches, k)) {
+                        return;
+                    }
+                    m_batches[k].lines.clear();
+                    m_batches[k].release = nil;
+                    m_batches[k].end = false;
+                }
+                m_batches[k].lines.push_back(line);
+            }
+
+            // The buffer is released after the last batch of the block.
+            m_batches[k].release = block.buffer;
+            if (!push(m_full_batches, k) || block.buffer == nil) {
+                return;
+            }
+        }
+    }
+
+    void guard(void (line_pipeline::*stage)())
+    {
+        try {
+            (this->*stage)();
+        } catch (...) {
+            fail(std::current_exception());
+        }
+    }
+
+    void fail(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) {
+            m_error = error;
+        }
+        m_stop.store(true);
+
+        std::lock_guard<std::mutex> wait_lock(m_wait_mutex);
+        m_wakeup.notify_all();
+    }
+
+    /// Pushes an element, waiting while the ring is full; \c false if stopped.
+    template <class value_type>
+    bool push(spsc_ring<value_type>& ring, const value_type& value)
+    {
+        if (!wait([&]() { return ring.try_push(value); })) {
+            return false;
+        }
+        notify();
+        return true;
+    }
+
+    /// Pops an element, waiting while the ring is empty; \c false if stopped.
+    template <class value_type>
+    bool pop(spsc_ring<value_type>& ring, value_type& value)
+    {
+        if (!wait([&]() { return ring.try_pop(value); })) {
+            return false;
+        }
+        notify();
+        return true;
+    }
+
+    /**
+     * Retries an operation on a ring until it succeeds, polling the ring
+     * spin_limit times and then sleeping until notify() or fail().
+     *  @return bool    \c true if the operation succeeded; \c false if
+     *                  the pipeline stopped.
+     */
+    template <class operation_type>
+    bool wait(operation_type operation)
+    {
+        for (int i = 0;i < spin_limit;++i) {
+            if (operation()) {
+                return true;
+            }
+            if (m_stop.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+
+        // Announce the sleep before the last check, so that a stage changing
+        // the ring after the check sees the waiter (see notify()).
+        m_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(m_wait_mutex);
+            while (!(done = operation()) && !m_stop.load()) {
+                m_wakeup.wait(lock);
+            }
+        }
+        m_waiters.fetch_sub(1);
+        return done;
+    }
+
+    /// Wakes the sleeping stages after a ring changed.
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (0 < m_waiters.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+            m_wakeup.notify_all();
+        }
+    }
+};
+
+#endif/*__PIPELINE_H__*/
@@ -0,0 +1,295 @@
+/*
+ *      Line reader over memory-mapped files and pipes.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __READER_H__
+#define __READER_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef  _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif/*_WIN32*/
+
+/**
+ * A splitter of a block of text into lines.
+ */
+class line_splitter
+{
+protected:
+    /// The beginning of the unread data.
+    const char *m_begin;
+    /// The end of the unread data.
+    const char *m_end;
+
+public:
+    /**
+     * Constructs a splitter.
+     *  @param  block   The block of text.
+     */
+    line_splitter(std::string_view block = std::string_view())
+        : m_begin(block.data()), m_end(block.data() + block.size())
+    {
+    }
+
+    /**
+     * Gets the next line.
+     *  @param  line    The view of the line, without the newline character.
+     *  @return bool    \c true if a line was found; \c false at the end.
+     */
+    bool next(std::string_view& line)
+    {
+        if (m_begin == m_end) {
+            return false;
+        }
+        const char *p = (const char*)std::memchr(m_begin, '\n', m_end - m_begin);
+        if (p != NULL) {
+            line = std::string_view(m_begin, p - m_begin);
+            m_begin = p + 1;
+        } else {
+            // The last line may lack a newline character.
+            line = std::string_view(m_begin, m_end - m_begin);
+            m_begin = m_end;
+        }
+        return true;
+    }
+};
+
+/**
+ * A reader that splits an input stream into lines without copying them.
+ *  A regular file is memory-mapped as a whole, and the lines are views of
+ *  the mapping. Other inputs (e.g., pipes) are read in large blocks into a
+ *  buffer, and the lines are views of the buffer. In both cases, a line is
+ *  valid until the next call of next().
+ *
+ *  The reader also hands out line-aligned blocks through read_block(),
+ *  so that multiple threads can split and count the lines of different
+ *  blocks. A reader must not be used with both next() and read_block().
+ */
+class line_reader
+{
+protected:
+    /// The file descriptor.
+    int m_fd;
+    /// The size of a block.
+    size_t m_block_size;
+    /// The memory-mapped region (NULL if the input is not mapped).
+    const char *m_map;
+    /// The size of the memory-mapped region.
+    size_t m_map_size;
+    /// The incomplete line carried over to the next block.
+    std::vector<char> m_carry;
+    /// The beginning of the unread data in the memory-mapped region.
+    const char *m_begin;
+    /// The end of the memory-mapped region.
+    const char *m_end;
+    /// Whether the input reached the end of file.
+    bool m_eof;
+    /// The time spent in reading the input, in seconds.
+    double m_read_time;
+    /// The buffer for the current block read by next().
+    std::vector<char> m_buffer;
+    /// The lines of the current block read by next().
+    line_splitter m_lines;
+
+public:
+    /**
+     * Constructs a reader.
+     *  @param  fd          The file descriptor to read.
+     *  @param  block_size  The size of a block.
+     */
+    line_reader(int fd, size_t block_size = 1 << 22)
+        : m_fd(fd), m_block_size(block_size), m_map(NULL), m_map_size(0),
+        m_begin(NULL), m_end(NULL), m_eof(false), m_read_time(0.)
+    {
+#ifndef _WIN32
+        struct stat st;
+        off_t offset = ::lseek(fd, 0, SEEK_CUR);
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 <= offset && offset < st.st_size) {
+            void *p = ::mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+                m_map = (const char*)p;
+                m_map_size = (size_t)st.st_size;
+                m_begin = m_map + offset;
+                m_end = m_map + m_map_size;
+            }
+        }
+#endif/*_WIN32*/
+    }
+
+    /**
+     * Destructs the reader.
+     */
+    virtual ~line_reader()
+    {
+#ifndef _WIN32
+        if (m_map != NULL) {
+            ::munmap((void*)m_map, m_map_size);
+        }
+#endif/*_WIN32*/
+    }
+
+private:
+    line_reader(const line_reader&);
+    line_reader& operator=(const line_reader&);
+
+public:
+    /**
+     * Reads the next line.
+     *  @param  line    The view of the line, without the newline character.
+     *  @return bool    \c true if a line was read; \c false at end of input.
+     *  @throws         std::runtime_error if reading failed.
+     */
+    bool next(std::string_view& line)
+    {
+        while (!m_lines.next(line)) {
+            std::string_view block;
+            if (!read_block(m_buffer, block)) {
+                return false;
+            }
+            m_lines = line_splitter(block);
+        }
+        return true;
+    }
+
+    /**
+     * Reads the next block of lines.
+     *  A block consists of complete lines (the last line of the input may
+     *  lack a newline character). It is a view of the memory-mapped region
+     *  if the input is mapped; otherwise, it is read into the buffer given
+     *  by the caller, and it is valid until the buffer is reused.
+     *  @param  buffer  The buffer for storing the block.
+     *  @param  block   The view of the block.
+     *  @return bool    \c true if a block was read; \c false at end of input.
+     *  @throws         std::runtime_error if reading failed.
+     */
+    bool read_block(std::vector<char>& buffer, std::string_view& block)
+    {
+        if (m_map != NULL) {
+            if (m_begin == m_end) {
+                return false;
+            }
+            const char *last = m_begin + std::min(m_block_size, (size_t)(m_end - m_begin));
+            if (last != m_end) {
+                // Extend the block to the end of the line.
+                const char *p = (const char*)std::memchr(last, '\n', m_end - last);
+                last = (p != NULL) ? p + 1 : m_end;
+            }
+            block = std::string_view(m_begin, last - m_begin);
+            m_begin = last;
+            return true;
+        }
+
+        // Start the block with the incomplete line of the previous block.
+        size_t n = m_carry.size();
+        if (buffer.size() < std::max(m_block_size, n * 2)) {
+            buffer.resize(std::max(m_block_size, n * 2));
+        }
+        if (0 < n) {
+            std::memcpy(&buffer[0], &m_carry[0], n);
+        }
+
+        for (;;) {
+            // Fill the buffer.
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            while (!m_eof && n < buffer.size()) {
+                size_t ret = fill(&buffer[n], buffer.size() - n);
+                n += ret;
+                m_eof = (ret == 0);
+            }
+            m_read_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (n == 0) {
+                m_carry.clear();
+                return false;
+            }
+            if (m_eof) {
+                m_carry.clear();
+                block = std::string_view(&buffer[0], n);
+                return true;
+            }
+
+            // Split the buffer after the last newline character.
+            const char *p = &buffer[n-1];
+            while (&buffer[0] <= p && *p != '\n') {
+                --p;
+            }
+            if (&buffer[0] <= p) {
+                size_t size = p + 1 - &buffer[0];
+                m_carry.assign(p + 1, (const char*)&buffer[0] + n);
+                block = std::string_view(&buffer[0], size);
+                return true;
+            }
+
+            // The buffer is too small for a line.
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+
+    /**
+     * Gets the time spent in reading the input.
+     *  The time of reading a memory-mapped input is not included, since
+     *  the pages are read when the lines are accessed.
+     *  @return double  The time in seconds.
+     */
+    double read_time() const
+    {
+        return m_read_time;
+    }
+
+protected:
+    size_t fill(char *q, size_t size)
+    {
+        for (;;) {
+#ifdef  _WIN32
+            int ret = ::_read(m_fd, q, (unsigned int)size);
+#else
+            ssize_t ret = ::read(m_fd, q, size);
+#endif/*_WIN32*/
+            if (0 <= ret) {
+                return (size_t)ret;
+            } else if (errno != EINTR) {
+                throw std::runtime_error("failed to read the input");
+            }
+        }
+    }
+};
+
+#endif/*__READER_H__*/
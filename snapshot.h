@@ -0,0 +1,407 @@
+/*
+ *      Binary snapshots of counters.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif/*_WIN32*/
+
+/*
+ * A snapshot file consists of a header and a sequence of sections. The
+ * header stores a magic string, the format version, the kind of the
+ * counter, the size of a key (0 for variable-length keys), and the size of
+ * a count. Every section is an array of fixed-size elements aligned to 8
+ * bytes, so that a loader can use the arrays in a memory-mapped file in
+ * place. Integers are stored in the native byte order.
+ */
+
+/// The magic string of a snapshot file.
+#define SNAPSHOT_MAGIC      "APXCSNAP"
+/// The version of the snapshot format.
+#define SNAPSHOT_VERSION    1
+
+/**
+ * Kinds of counters in snapshots.
+ */
+enum {
+    SNAPSHOT_EXACT = 1,
+    SNAPSHOT_SPACESAVING = 2,
+    SNAPSHOT_SPACESAVING_PRIORITYQ = 3,
+    SNAPSHOT_COUNTMIN = 4,
+    SNAPSHOT_MISRAGRIES = 5,
+    SNAPSHOT_LOSSYCOUNTING = 6,
+};
+
+/**
+ * The header of a snapshot file.
+ */
+struct snapshot_header
+{
+    char magic[8];          ///< The magic string.
+    uint32_t version;       ///< The format version.
+    uint32_t kind;          ///< The kind of the counter.
+    uint32_t key_size;      ///< The size of a key (0 for variable length).
+    uint32_t count_size;    ///< The size of a count.
+};
+
+/**
+ * Key serialization.
+ *  Fixed-size keys are stored as their object representation; strings are
+ *  stored as their characters.
+ */
+template <class key_type>
+struct snapshot_key
+{
+    static const uint32_t size = sizeof(key_type);
+
+    static std::string_view bytes(const key_type& key)
+    {
+        return std::string_view((const char*)&key, sizeof(key_type));
+    }
+
+    static bool assign(key_type& key, std::string_view bytes)
+    {
+        if (bytes.size() != sizeof(key_type)) {
+            return false;
+        }
+        std::memcpy(&key, bytes.data(), sizeof(key_type));
+        return true;
+    }
+};
+
+template <>
+struct snapshot_key<std::string>
+{
+    static const uint32_t size = 0;
+
+    static std::string_view bytes(const std::string& key)
+    {
+        return std::string_view(key);
+    }
+
+    static bool assign(std::string& key, std::string_view bytes)
+    {
+        key.assign(bytes.data(), bytes.size());
+        return true;
+    }
+};
+
+/**
+ * A writer of a snapshot file.
+ *  The writer writes to a temporary file and renames it to the target in
+ *  close(), so that an interrupted write never destroys an older snapshot.
+ */
+class snapshot_writer
+{
+protected:
+    std::string m_path;
+    std::string m_tmp;
+    FILE *m_fp;
+    uint64_t m_offset;
+
+public:
+    /**
+     * Opens a snapshot file for writing.
+     *  @param  path    The path to the snapshot file.
+     *  @param  kind    The kind of the counter.
+     *  @param  key_size    The size of a key (0 for variable length).
+     *  @param  count_size  The size of a count.
+     *  @throws         std::runtime_error
+     */
+    snapshot_writer(const std::string& path, uint32_t kind, uint32_t key_size, uint32_t count_size)
+        : m_path(path), m_tmp(path + ".tmp"), m_fp(NULL), m_offset(0)
+    {
+        m_fp = std::fopen(m_tmp.c_str(), "wb");
+        if (m_fp == NULL) {
+            throw std::runtime_error("failed to open the snapshot file: " + m_tmp);
+        }
+
+        snapshot_header header;
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.kind = kind;
+        header.key_size = key_size;
+        header.count_size = count_size;
+        write(&header, sizeof(header));
+    }
+
+    virtual ~snapshot_writer()
+    {
+        if (m_fp != NULL) {
+            std::fclose(m_fp);
+            std::remove(m_tmp.c_str());
+        }
+    }
+
+private:
+    snapshot_writer(const snapshot_writer&);
+    snapshot_writer& operator=(const snapshot_writer&);
+
+public:
+    /**
+     * Writes a 64-bit integer.
+     */
+    void put(uint64_t value)
+    {
+        write(&value, sizeof(value));
+    }
+
+    /**
+     * Writes an array of elements as a section.
+     */
+    template <class value_type>
+    void put_array(const value_type *values, size_t n)
+    {
+        write(values, sizeof(value_type) * n);
+        align();
+    }
+
+    /**
+     * Finishes writing and replaces the target file with the snapshot.
+     *  @throws         std::runtime_error
+     */
+    void close()
+    {
+        FILE *fp = m_fp;
+        m_fp = NULL;
+        if (std::fclose(fp) != 0 || std::rename(m_tmp.c_str(), m_path.c_str()) != 0) {
+            std::remove(m_tmp.c_str());
+            throw std::runtime_error("failed to write the snapshot file: " + m_path);
+        }
+    }
+
+protected:
+    void write(const void *data, size_t size)
+    {
+        if (0 < size && std::fwrite(data, 1, size, m_fp) != size) {
+            throw std::runtime_error("failed to write the snapshot file: " + m_tmp);
+        }
+        m_offset += size;
+    }
+
+    void align()
+    {
+        static const char zeros[8] = {0};
+        if (m_offset % 8 != 0) {
+            write(zeros, 8 - m_offset % 8);
+        }
+    }
+};
+
+/**
+ * A reader of a snapshot file.
+ *  The reader maps the whole file into memory, and returns the sections as
+ *  pointers into the mapping.
+ */
+class snapshot_reader
+{
+protected:
+    std::string m_path;
+    const char *m_data;
+    size_t m_size;
+    size_t m_offset;
+    std::vector<char> m_buffer;
+
+public:
+    /**
+     * Opens a snapshot file for reading.
+     *  @param  path    The path to the snapshot file.
+     *  @param  kind    The kind of the counter.
+     *  @param  key_size    The size of a key (0 for variable length).
+     *  @param  count_size  The size of a count.
+     *  @throws         std::runtime_error
+     */
+    snapshot_reader(const std::string& path, uint32_t kind, uint32_t key_size, uint32_t count_size)
+        : m_path(path), m_data(NULL), m_size(0), m_offset(0)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0) {
+            if (0 <= fd) {
+                ::close(fd);
+            }
+            throw std::runtime_error("failed to open the snapshot file: " + path);
+        }
+        m_size = (size_t)st.st_size;
+        if (0 < m_size) {
+            void *p = ::mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("failed to map the snapshot file: " + path);
+            }
+            m_data = (const char*)p;
+        }
+        ::close(fd);
+#else
+        FILE *fp = std::fopen(path.c_str(), "rb");
+        if (fp == NULL) {
+            throw std::runtime_error("failed to open the snapshot file: " + path);
+        }
+        char buffer[65536];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+            m_buffer.insert(m_buffer.end(), buffer, buffer + n);
+        }
+        std::fclose(fp);
+        m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+        m_size = m_buffer.size();
+#endif/*_WIN32*/
+
+        const snapshot_header *header = get_array<snapshot_header>(1, false);
+        if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+            throw std::runtime_error("not a snapshot file: " + path);
+        }
+        if (header->version != SNAPSHOT_VERSION) {
+            throw std::runtime_error("unsupported snapshot version: " + path);
+        }
+        if (header->kind != kind || header->key_size != key_size || header->count_size != count_size) {
+            throw std::runtime_error("the snapshot was made with a different algorithm or type: " + path);
+        }
+    }
+
+    virtual ~snapshot_reader()
+    {
+#ifndef _WIN32
+        if (m_data != NULL) {
+            ::munmap((void*)m_data, m_size);
+        }
+#endif/*_WIN32*/
+    }
+
+private:
+    snapshot_reader(const snapshot_reader&);
+    snapshot_reader& operator=(const snapshot_reader&);
+
+public:
+    /**
+     * Reads a 64-bit integer.
+     *  @throws         std::runtime_error
+     */
+    uint64_t get()
+    {
+        return *get_array<uint64_t>(1, false);
+    }
+
+    /**
+     * Reads a section of elements.
+     *  @param  n       The number of elements.
+     *  @return         The pointer to the elements in the mapping.
+     *  @throws         std::runtime_error
+     */
+    template <class value_type>
+    const value_type *get_array(size_t n, bool aligned = true)
+    {
+        size_t size = sizeof(value_type) * n;
+        if (n != 0 && size / n != sizeof(value_type)) {
+            throw std::runtime_error("broken snapshot file: " + m_path);
+        }
+        if (m_size < m_offset || m_size - m_offset < size) {
+            throw std::runtime_error("truncated snapshot file: " + m_path);
+        }
+        const value_type *p = (const value_type*)(m_data + m_offset);
+        m_offset += size;
+        if (aligned && m_offset % 8 != 0) {
+            m_offset += 8 - m_offset % 8;
+        }
+        return p;
+    }
+
+    /**
+     * Throws an exception for an inconsistent snapshot.
+     */
+    void fail()
+    {
+        throw std::runtime_error("broken snapshot file: " + m_path);
+    }
+};
+
+/**
+ * Writes the keys of items as two sections: the offsets and the bytes.
+ *  @param  writer  The writer.
+ *  @param  first   The iterator to the first item.
+ *  @param  n       The number of items.
+ *  @param  get_key The function receiving an item and returning its key.
+ */
+template <class key_type, class iterator_type, class get_key_type>
+void snapshot_put_keys(snapshot_writer& writer, iterator_type first, size_t n, get_key_type get_key)
+{
+    std::vector<uint64_t> offsets(n+1, 0);
+    std::string bytes;
+    iterator_type it = first;
+    for (size_t i = 0;i < n;++i, ++it) {
+        bytes += snapshot_key<key_type>::bytes(get_key(*it));
+        offsets[i+1] = bytes.size();
+    }
+    writer.put_array(&offsets[0], n+1);
+    writer.put_array(bytes.data(), bytes.size());
+}
+
+/**
+ * Reads the keys written by snapshot_put_keys().
+ *  @param  reader  The reader.
+ *  @param  n       The number of items.
+ *  @param  set_key The function receiving an item number and the bytes of
+ *                  its key, and returning \c false if the key is invalid.
+ */
+template <class set_key_type>
+void snapshot_get_keys(snapshot_reader& reader, size_t n, set_key_type set_key)
+{
+    const uint64_t *offsets = reader.get_array<uint64_t>(n+1);
+    if (offsets[0] != 0) {
+        reader.fail();
+    }
+    for (size_t i = 0;i < n;++i) {
+        if (offsets[i+1] < offsets[i]) {
+            reader.fail();
+        }
+    }
+    const char *bytes = reader.get_array<char>(offsets[n]);
+    for (size_t i = 0;i < n;++i) {
+        if (!set_key(i, std::string_view(bytes + offsets[i], offsets[i+1] - offsets[i]))) {
+            reader.fail();
+        }
+    }
+}
+
+#endif/*__SNAPSHOT_H__*/
@@ -31,11 +31,35 @@
 #ifndef __SPACESAVING_H__
 #define __SPACESAVING_H__
 
-#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <vector>
 #include <cassert>
+#include <ostream>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "snapshot.h"
+#include "stats.h"
 
 /**
  * Space-saving algorithm.
+ *  The summary is a stream summary: the items with the same count are
+ *  chained in a bucket, and the buckets are chained in the ascending order
+ *  of their counts. Items and buckets live in two contiguous pools, and
+ *  the links between them are 32-bit positions in the pools instead of
+ *  pointers, which halves the size of the links and keeps the chains of
+ *  neighbouring items in nearby cache lines. An item also stores its count
+ *  inline, so that reading a count does not touch the bucket.
+ *
+ *  An occurrence moves an item to the next bucket in O(1) time. A weighted
+ *  update (append(key, weight)) may skip any number of buckets: the
+ *  summary walks a few buckets from the current one, and otherwise finds
+ *  the destination bucket through an ordered index of the buckets by their
+ *  counts, in O(log(number of buckets)) time. The index is built when a
+ *  walk first falls short and maintained afterwards, so that counting
+ *  single occurrences or small weights does not pay for it.
  *  @param  key_tmpl        Key type.
  *  @param  count_tmpl      Count type.
  */
@@ -49,9 +73,12 @@ public:
     typedef count_tmpl count_type;
     /// This class.
     typedef spacesaving<key_tmpl, count_tmpl> this_type;
+    /// The type for looking up a key (e.g., std::string_view for strings).
+    typedef typename key_traits<key_tmpl>::view_type key_view;
 
 protected:
-    struct bucket_t;
+    /// The position representing no item or bucket.
+    static const uint32_t nil = 0xFFFFFFFF;
 
 public:
     /**
@@ -64,10 +91,12 @@ public:
 
     protected:
         key_type key;       ///< The key
+        uint32_t hash;      ///< The hash value of the key.
+        count_type count;   ///< Item count (the count of the parent bucket).
         count_type eps;     ///< Epsilon (maximum overestimation of the count)
-        bucket_t *parent;   ///< Pointer to the bucket owning this item.
-        item_type *prev;    ///< Pointer to the previous item.
-        item_type *next;    ///< Pointer to the next item.
+        uint32_t parent;    ///< Position of the bucket owning this item.
+        uint32_t prev;      ///< Position of the previous item.
+        uint32_t next;      ///< Position of the next item.
 
     public:
         /**
@@ -75,7 +104,7 @@ public:
          *  @param  e       The epsilon value.
          */
         item_type(count_type e=0)
-            : eps(e), parent(NULL), prev(NULL), next(NULL)
+            : hash(0), count(0), eps(e), parent(nil), prev(nil), next(nil)
         {
         }
 
@@ -85,7 +114,7 @@ public:
          *  @param  e       The epsilon value.
          */
         item_type(const key_type& k, count_type e=0)
-            : key(k), eps(e), parent(NULL), prev(NULL), next(NULL)
+            : key(k), hash(0), count(0), eps(e), parent(nil), prev(nil), next(nil)
         {
         }
 
@@ -104,7 +133,7 @@ public:
          */
         count_type get_count() const
         {
-            return parent->count;
+            return this->count;
         }
 
         /**
@@ -125,40 +154,73 @@ protected:
     struct bucket_t
     {
         count_type count;   ///< Item count.
-        item_type *head;    ///< Pointer to the first item.
-        item_type *tail;    ///< Pointer to the last item.
-        bucket_t *prev;     ///< Pointer to the previous bucket.
-        bucket_t *next;     ///< Pointer to the next bucket.
+        uint32_t head;      ///< Position of the first item.
+        uint32_t tail;      ///< Position of the last item.
+        uint32_t prev;      ///< Position of the previous bucket.
+        uint32_t next;      ///< Position of the next bucket.
 
         /**
          * Constructs a bucket.
          *  @param  c       The count value.
          */
         bucket_t(count_type c=0) :
-            count(c), head(NULL), tail(NULL), prev(NULL), next(NULL)
+            count(c), head(nil), tail(nil), prev(nil), next(nil)
         {
         }
     };
 
 protected:
-    /// A mapping type: key -> *item.
-    typedef std::unordered_map<key_type, item_type*> keys_t;
-    /// The mapping object: key -> *item.
-    keys_t m_keys;
+    /// Key hashing.
+    typedef key_traits<key_type> traits_t;
+    /// The ordered index: count -> position of the bucket.
+    typedef std::map<count_type, uint32_t> bucket_index_t;
+    /// The mapping object: key -> index of the item in the item pool.
+    keyindex m_keys;
     /// The total frequency.
     count_type m_n;
     /// The maximum number of counters.
     count_type m_m;
-    /// The pointer to the first bucket.
-    bucket_t *m_root;
+    /// The position of the first bucket.
+    uint32_t m_root;
+    /// The position of the last bucket (storing the largest count).
+    uint32_t m_tail;
+    /// The pool of items (preallocated for m_m items).
+    std::vector<item_type> m_items;
+    /// The number of items in use in the item pool.
+    size_t m_num_items;
+    /// The pool of buckets (preallocated for m_m+1 buckets).
+    std::vector<bucket_t> m_buckets;
+    /// The list of unused buckets in the bucket pool (chained by next).
+    uint32_t m_free;
+    /// The index of the buckets by their counts (used by weighted updates).
+    bucket_index_t m_bucket_index;
+    /// The entries of the buckets in the index.
+    std::vector<typename bucket_index_t::iterator> m_bucket_entries;
+    /// Whether m_bucket_index is maintained.
+    bool m_indexed;
+
+    /**
+     * Statistics of the updates (counted if USE_COUNTER_STATS is defined).
+     */
+    struct stats_t
+    {
+        uint64_t hits;          ///< Updates of keys with counters.
+        uint64_t inserts;       ///< Updates assigning unused counters.
+        uint64_t replacements;  ///< Updates evicting the minimum items.
+        uint64_t bucket_creations;      ///< Buckets created by updates.
+        uint64_t bucket_destructions;   ///< Buckets erased by updates.
+    } m_stats;
 
 public:
     /**
      * Constructs an object.
      *  @param  m       The maximum number of counters.
      */
-    spacesaving(count_type m=4) : m_root(NULL), m_n(0), m_m(m)
+    spacesaving(count_type m=4)
+        : m_keys(m), m_n(0), m_m(m), m_root(nil), m_tail(nil), m_items(m), m_num_items(0),
+        m_buckets((size_t)m+1), m_free(nil), m_indexed(false), m_stats()
     {
+        clear();
     }
 
     /**
@@ -168,80 +230,528 @@ public:
     {
     }
 
+private:
+    // Items are handed out as pointers into the pool owned by this object.
+    spacesaving(const spacesaving&);
+    spacesaving& operator=(const spacesaving&);
+
+    /**
+     * Removes all counters.
+     */
+    void clear()
+    {
+        m_keys.clear();
+        m_n = 0;
+        m_root = nil;
+        m_tail = nil;
+        m_num_items = 0;
+        m_bucket_index.clear();
+        m_indexed = false;
+
+        // Every count value needs at most one bucket, and increment() may
+        // hold one more bucket transiently before erasing an empty one.
+        m_free = nil;
+        for (size_t i = m_buckets.size();0 < i;--i) {
+            release_bucket((uint32_t)(i-1));
+        }
+    }
+
 protected:
-    void increment(item_type* item)
+    void increment(uint32_t i)
     {
+        item_type& item = m_items[i];
+
         // The bucket storing the item.
-        bucket_t *bucket = item->parent;
+        uint32_t b = item.parent;
+        bucket_t& bucket = m_buckets[b];
 
         // Detach the item from the bucket.
-        detach_item(item);
+        detach_item(i);
 
         // Incremented count of the item.
-        count_type count = bucket->count+1;
+        count_type count = bucket.count+1;
+        item.count = count;
 
         // Find the right bucket for storing the item (for the incremented count).
-        if (bucket->next != NULL && bucket->next->count == count) {
+        if (bucket.next != nil && m_buckets[bucket.next].count == count) {
             // Attach the item to the next bucket.
-            append_item(bucket->next, item);
+            append_item(bucket.next, i);
         } else {
             // Create a new bucket and insert it after the bucket.
-            bucket_t *new_bucket = new bucket_t(count);
-            insert_bucket(bucket, new_bucket);
-            append_item(new_bucket, item);
+            uint32_t new_bucket = acquire_bucket(count);
+            insert_bucket(b, new_bucket);
+            append_item(new_bucket, i);
+            COUNTER_STATS(++m_stats.bucket_creations);
         }
 
         // Remove the bucket if it is empty.
-        if (bucket->head == NULL) {
-            assert(bucket->tail == NULL);
-            erase_bucket(bucket);
-            delete bucket;
+        if (bucket.head == nil) {
+            assert(bucket.tail == nil);
+            erase_bucket(b);
+            release_bucket(b);
+            COUNTER_STATS(++m_stats.bucket_destructions);
+        }
+    }
+
+    /**
+     * Moves an item to the bucket of a larger count (for weighted updates).
+     *  @param  i       The position of the item.
+     *  @param  count   The new count of the item.
+     */
+    void increment(uint32_t i, count_type count)
+    {
+        uint32_t b = m_items[i].parent;
+        detach_item(i);
+        place_item(i, count, b);
+        if (m_buckets[b].head == nil) {
+            erase_bucket(b);
+            release_bucket(b);
+            COUNTER_STATS(++m_stats.bucket_destructions);
+        }
+    }
+
+    /**
+     * Attaches a detached item to the bucket of a count, creating the
+     * bucket if necessary.
+     *  @param  i       The position of the item.
+     *  @param  count   The count of the item.
+     *  @param  from    The bucket from which the destination is searched
+     *                  (its count must be smaller than the count), or nil
+     *                  to search from the root.
+     */
+    void place_item(uint32_t i, count_type count, uint32_t from)
+    {
+        m_items[i].count = count;
+
+        // Small weights move an item by a few buckets: walk the chain
+        // before falling back to the index.
+        uint32_t prev = from;
+        uint32_t next = (from != nil) ? m_buckets[from].next : m_root;
+        for (int step = 0;;++step) {
+            if (next == nil || count < m_buckets[next].count) {
+                break;
+            } else if (m_buckets[next].count == count) {
+                append_item(next, i);
+                return;
+            } else if (step == max_walk) {
+                if (!m_indexed) {
+                    build_bucket_index();
+                }
+                typename bucket_index_t::const_iterator it = m_bucket_index.lower_bound(count);
+                if (it != m_bucket_index.end() && it->first == count) {
+                    append_item(it->second, i);
+                    return;
+                }
+                prev = std::prev(it)->second;
+                break;
+            }
+            prev = next;
+            next = m_buckets[next].next;
+        }
+
+        // Insert a new bucket after the one with the largest smaller count.
+        uint32_t bucket = acquire_bucket(count);
+        if (prev != nil) {
+            insert_bucket(prev, bucket);
+        } else {
+            insert_root_bucket(bucket);
+        }
+        append_item(bucket, i);
+        COUNTER_STATS(++m_stats.bucket_creations);
+    }
+
+    /**
+     * Builds the bucket index from the bucket chain.
+     */
+    void build_bucket_index()
+    {
+        m_bucket_index.clear();
+        m_bucket_entries.resize(m_buckets.size());
+        for (uint32_t b = m_root;b != nil;b = m_buckets[b].next) {
+            m_bucket_entries[b] = m_bucket_index.emplace_hint(m_bucket_index.end(), m_buckets[b].count, b);
+        }
+        m_indexed = true;
+    }
+
+    /**
+     * Adds a bucket linked into the bucket chain to the index, if the
+     * index is maintained. The next bucket locates the entry in O(1) time.
+     */
+    void index_bucket(uint32_t b)
+    {
+        if (m_indexed) {
+            uint32_t next = m_buckets[b].next;
+            typename bucket_index_t::iterator hint = (next != nil) ? m_bucket_entries[next] : m_bucket_index.end();
+            m_bucket_entries[b] = m_bucket_index.emplace_hint(hint, m_buckets[b].count, b);
         }
     }
 
 public:
-    void append(const key_type& key)
+    /**
+     * Counts an occurrence of a key.
+     *  @param  key     The key.
+     *  @return bool    \c true if a counter was assigned to the key (i.e.,
+     *                  the key was not counted before this call).
+     */
+    bool append(const key_view& key)
+    {
+        return update(key, traits_t::hash(key));
+    }
+
+    /**
+     * Counts occurrences of a key.
+     *  An item moves directly to the bucket of its new count, which is
+     *  found through the bucket index in O(log(number of buckets)) time.
+     *  A zero weight counts nothing.
+     *  @param  key     The key.
+     *  @param  weight  The number of occurrences.
+     *  @return bool    \c true if a counter was assigned to the key (i.e.,
+     *                  the key was not counted before this call).
+     */
+    bool append(const key_view& key, count_type weight)
+    {
+        return update(key, traits_t::hash(key), weight);
+    }
+
+    /**
+     * Counts occurrences of a batch of keys.
+     *  This is equivalent to calling append() for every key in order, but
+     *  it hashes the keys in advance and prefetches the slots of the key
+     *  index and the items a few keys ahead, so that the cache misses of
+     *  successive keys overlap.
+     *  @param  keys    The array of keys.
+     *  @param  n       The number of keys.
+     *  @param  weights The array of the numbers of occurrences (NULL for
+     *                  one occurrence per key).
+     */
+    void append_batch(const key_view* keys, size_t n, const count_type* weights=NULL)
     {
-        typename keys_t::iterator it = m_keys.find(key);
-        if (it != m_keys.end()) {
+        uint32_t hashes[batch_size];
+        for (size_t offset = 0;offset < n;offset += batch_size) {
+            size_t size = std::min(batch_size, n - offset);
+            const key_view *batch = keys + offset;
+            for (size_t i = 0;i < size;++i) {
+                hashes[i] = traits_t::hash(batch[i]);
+            }
+            for (size_t i = 0;i < size && i < prefetch_distance;++i) {
+                m_keys.prefetch(hashes[i]);
+            }
+            for (size_t i = 0;i < size;++i) {
+                if (i + prefetch_distance < size) {
+                    m_keys.prefetch(hashes[i + prefetch_distance]);
+                }
+                if (i + prefetch_distance / 2 < size) {
+                    prefetch_item(hashes[i + prefetch_distance / 2]);
+                }
+                if (weights != NULL) {
+                    update(batch[i], hashes[i], weights[offset + i]);
+                } else {
+                    update(batch[i], hashes[i]);
+                }
+            }
+        }
+    }
+
+protected:
+    /// The number of keys hashed in advance by append_batch().
+    static constexpr size_t batch_size = 64;
+    /// The distance of prefetching in append_batch().
+    static constexpr size_t prefetch_distance = 8;
+    /// The number of buckets walked by a weighted update before using the
+    /// bucket index.
+    static constexpr int max_walk = 4;
+
+    /**
+     * Prefetches the item of a key, if the home slot of the key in the key
+     * index (prefetched earlier) points to it.
+     */
+    void prefetch_item(uint32_t hash) const
+    {
+        uint32_t i = m_keys.peek(hash);
+        if (i != keyindex::npos) {
+            KEYINDEX_PREFETCH(&m_items[i]);
+        }
+    }
+
+    bool update(const key_view& key, uint32_t hash)
+    {
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        ++m_n;
+        if (i != keyindex::npos) {
             // Increment the counter.
-            this->increment(it->second);
-        } else if ((count_type)m_keys.size() < m_m) {
+            COUNTER_STATS(++m_stats.hits);
+            this->increment(i);
+            return false;
+        } else if (m_num_items < (size_t)m_m) {
             // Create an item and insert it into the root bucket.
-            if (m_root == NULL || 1 < m_root->count) {
+            if (m_root == nil || 1 < m_buckets[m_root].count) {
                 // Create the root (count=1) bucket.
-                m_root = new bucket_t(1);
+                insert_root_bucket(acquire_bucket(1));
+                COUNTER_STATS(++m_stats.bucket_creations);
             }
-            item_type *item = new item_type(key);
-            append_item(m_root, item);
-            m_keys[key] = item;
+            uint32_t j = (uint32_t)m_num_items++;
+            item_type& item = m_items[j];
+            item.key = key;
+            item.hash = hash;
+            item.count = 1;
+            item.eps = 0;
+            append_item(m_root, j);
+            m_keys.insert(hash, j);
+            COUNTER_STATS(++m_stats.inserts);
+            return true;
         } else {
             // The replacement step.
-            bucket_t *bucket = m_root;
-            item_type *item = bucket->head;
-            m_keys.erase(item->key);
-            item->key = key;
-            item->eps = bucket->count;
-            this->increment(item);
-            m_keys[key] = item;
+            COUNTER_STATS(++m_stats.replacements);
+            uint32_t j = m_buckets[m_root].head;
+            item_type& item = m_items[j];
+            // Overwrite the evicted item (and its key storage) in place.
+            m_keys.erase(item.hash, j);
+            m_keys.insert(hash, j);
+            item.key = key;
+            item.hash = hash;
+            item.eps = item.count;
+            this->increment(j);
+            return true;
         }
-        ++m_n;
+    }
+
+    bool update(const key_view& key, uint32_t hash, count_type weight)
+    {
+        if (weight == 1) {
+            return update(key, hash);
+        } else if (weight == 0) {
+            return false;
+        }
+
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        m_n += weight;
+        if (i != keyindex::npos) {
+            // Add the weight to the counter.
+            COUNTER_STATS(++m_stats.hits);
+            this->increment(i, m_items[i].count + weight);
+            return false;
+        } else if (m_num_items < (size_t)m_m) {
+            // Create an item with the weight as its count.
+            uint32_t j = (uint32_t)m_num_items++;
+            item_type& item = m_items[j];
+            item.key = key;
+            item.hash = hash;
+            item.eps = 0;
+            place_item(j, weight, nil);
+            m_keys.insert(hash, j);
+            COUNTER_STATS(++m_stats.inserts);
+            return true;
+        } else {
+            // The replacement step.
+            COUNTER_STATS(++m_stats.replacements);
+            uint32_t j = m_buckets[m_root].head;
+            item_type& item = m_items[j];
+            m_keys.erase(item.hash, j);
+            m_keys.insert(hash, j);
+            item.key = key;
+            item.hash = hash;
+            item.eps = item.count;
+            this->increment(j, item.count + weight);
+            return true;
+        }
+    }
+
+public:
+    /**
+     * Merges another summary into this summary.
+     *  This implements the combine step of mergeable summaries: a key
+     *  missing in a summary is regarded to have the minimum count of the
+     *  summary as its count and epsilon (zero if the summary does not use
+     *  all counters), the counts and epsilons of both summaries are added,
+     *  and the m items with the largest counts are kept. Thus, the merged
+     *  summary never underestimates a count, and its epsilon values are at
+     *  most (n1+n2)/m.
+     *  @param  other   The summary to be merged into this summary.
+     */
+    void merge(const spacesaving& other)
+    {
+        std::vector<entry_t> entries;
+        entries.reserve(m_num_items + other.m_num_items);
+        count_type min1 = this->min_count();
+        count_type min2 = other.min_count();
+
+        // Items of this summary (and of both summaries).
+        for (item_type *item = top();item != NULL;item = next(item)) {
+            const item_type *x = other.find(item->key, item->hash);
+            entry_t entry;
+            entry.item = item;
+            entry.count = item->get_count() + (x != NULL ? x->get_count() : min2);
+            entry.eps = item->eps + (x != NULL ? x->eps : min2);
+            entries.push_back(entry);
+        }
+
+        // Items only in the other summary.
+        for (size_t i = 0;i < other.m_num_items;++i) {
+            const item_type *x = &other.m_items[i];
+            if (this->find(x->key, x->hash) == NULL) {
+                entry_t entry;
+                entry.item = x;
+                entry.count = x->get_count() + min1;
+                entry.eps = x->eps + min1;
+                entries.push_back(entry);
+            }
+        }
+
+        // Keep the m items with the largest counts (stable for ties).
+        std::stable_sort(entries.begin(), entries.end(), [](const entry_t& x, const entry_t& y) {
+            return x.count > y.count;
+        });
+        if (entries.size() > (size_t)m_m) {
+            entries.resize((size_t)m_m);
+        }
+
+        // Rebuild this summary from the items in the ascending order.
+        std::vector<key_type> keys(entries.size());
+        for (size_t i = 0;i < entries.size();++i) {
+            keys[i] = entries[i].item->key;
+        }
+        count_type n = m_n + other.m_n;
+        clear();
+        uint32_t last = nil;
+        for (size_t i = entries.size();0 < i;--i) {
+            const entry_t& entry = entries[i-1];
+            push_item(last, keys[i-1], traits_t::hash(keys[i-1]), entry.count, entry.eps);
+        }
+        m_n = n;
+
+        m_stats.hits += other.m_stats.hits;
+        m_stats.inserts += other.m_stats.inserts;
+        m_stats.replacements += other.m_stats.replacements;
+        m_stats.bucket_creations += other.m_stats.bucket_creations;
+        m_stats.bucket_destructions += other.m_stats.bucket_destructions;
+    }
+
+    /**
+     * Saves the summary to a snapshot file.
+     *  The snapshot stores the items in the item pool (counts, epsilons,
+     *  hash values, and keys), the order of the items in the bucket chain,
+     *  and the slots of the key index.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void save(const std::string& path) const
+    {
+        size_t n = m_num_items;
+        std::vector<uint32_t> order, hashes(n);
+        std::vector<count_type> counts(n), eps(n);
+        order.reserve(n);
+        for (uint32_t b = m_root;b != nil;b = m_buckets[b].next) {
+            for (uint32_t i = m_buckets[b].head;i != nil;i = m_items[i].next) {
+                order.push_back(i);
+            }
+        }
+        for (size_t i = 0;i < n;++i) {
+            counts[i] = m_items[i].count;
+            eps[i] = m_items[i].eps;
+            hashes[i] = m_items[i].hash;
+        }
+
+        snapshot_writer writer(path, SNAPSHOT_SPACESAVING, snapshot_key<key_type>::size, sizeof(count_type));
+        writer.put(m_n);
+        writer.put(m_m);
+        writer.put(n);
+        writer.put_array(order.data(), n);
+        writer.put_array(counts.data(), n);
+        writer.put_array(eps.data(), n);
+        writer.put_array(hashes.data(), n);
+        snapshot_put_keys<key_type>(writer, m_items.begin(), n, [](const item_type& item) -> const key_type& {
+            return item.key;
+        });
+        writer.put(m_keys.num_slots());
+        writer.put_array(m_keys.data(), 2 * m_keys.num_slots());
+        writer.close();
+    }
+
+    /**
+     * Loads the summary from a snapshot file.
+     *  This replaces the current state, including the number of counters.
+     *  The key index is copied from the snapshot as is, without rehashing.
+     *  @param  path    The path to the snapshot file.
+     *  @throws         std::runtime_error
+     */
+    void load(const std::string& path)
+    {
+        snapshot_reader reader(path, SNAPSHOT_SPACESAVING, snapshot_key<key_type>::size, sizeof(count_type));
+        count_type total = (count_type)reader.get();
+        count_type m = (count_type)reader.get();
+        size_t n = (size_t)reader.get();
+        if (m < 1 || n > (size_t)m) {
+            reader.fail();
+        }
+
+        if (m != m_m) {
+            m_m = m;
+            m_keys = keyindex(m);
+            m_items.assign(m, item_type());
+            m_buckets.assign((size_t)m+1, bucket_t());
+        }
+        clear();
+
+        const uint32_t *order = reader.get_array<uint32_t>(n);
+        const count_type *counts = reader.get_array<count_type>(n);
+        const count_type *eps = reader.get_array<count_type>(n);
+        const uint32_t *hashes = reader.get_array<uint32_t>(n);
+        snapshot_get_keys(reader, n, [&](size_t i, std::string_view bytes) {
+            m_items[i].hash = hashes[i];
+            m_items[i].eps = eps[i];
+            return snapshot_key<key_type>::assign(m_items[i].key, bytes);
+        });
+
+        // Rebuild the bucket chain in the ascending order of counts.
+        std::vector<bool> used(n, false);
+        uint32_t last = nil;
+        for (size_t i = 0;i < n;++i) {
+            uint32_t j = order[i];
+            if (n <= j || used[j] || (last != nil && counts[j] < m_buckets[last].count)) {
+                reader.fail();
+            }
+            used[j] = true;
+            link_item(last, j, counts[j]);
+        }
+        m_num_items = n;
+
+        if ((size_t)reader.get() != m_keys.num_slots()) {
+            reader.fail();
+        }
+        const uint32_t *slots = reader.get_array<uint32_t>(2 * m_keys.num_slots());
+        size_t size = 0;
+        for (size_t i = 0;i < m_keys.num_slots();++i) {
+            if (slots[2*i+1] != keyindex::npos) {
+                if (n <= slots[2*i+1]) {
+                    reader.fail();
+                }
+                ++size;
+            }
+        }
+        if (size != n) {
+            reader.fail();
+        }
+        m_keys.assign(slots, n);
+        m_n = total;
     }
 
     void debug(std::ostream& os)
     {
         os << "[keys]" << std::endl;
-        for (typename keys_t::const_iterator it = m_keys.begin();it != m_keys.end();++it) {
-            os << it->first << ": " << it->second->parent->count << "(" << it->second->eps << ")" << std::endl;
+        for (size_t i = 0;i < m_num_items;++i) {
+            const item_type& item = m_items[i];
+            os << item.key << ": " << item.count << "(" << item.eps << ")" << std::endl;
         }
 
-        bucket_t *bucket = m_root;
         os << "items {" << std::endl;
-        for (;bucket != NULL;bucket = bucket->next) {
-            os << "  count " << bucket->count << " {" << std::endl;
-            item_type *item = bucket->head;
-            for (;item != NULL;item = item->next) {
-                os << "    " << item->key << std::endl;
+        for (uint32_t b = m_root;b != nil;b = m_buckets[b].next) {
+            os << "  count " << m_buckets[b].count << " {" << std::endl;
+            for (uint32_t i = m_buckets[b].head;i != nil;i = m_items[i].next) {
+                os << "    " << m_items[i].key << std::endl;
             }
             os << "  }" << std::endl;
         }
@@ -253,112 +763,257 @@ public:
         return m_n;
     }
 
-    item_type *top()
+    /**
+     * Writes the statistics of the summary.
+     *  The number of items per bucket is measured at the time of the call.
+     *  @param  writer  The writer.
+     */
+    void write_stats(stats_writer& writer) const
     {
-        bucket_t *bucket = m_root;
-        if (bucket != NULL) {
-            while (bucket->next != NULL) {
-                bucket = bucket->next;
-            }
-            return bucket->tail;
-        } else {
-            return NULL;
+        size_t num_buckets = 0;
+        for (uint32_t b = m_root;b != nil;b = m_buckets[b].next) {
+            ++num_buckets;
         }
+        writer.add("counters", (uint64_t)m_m);
+        writer.add("items", (uint64_t)m_num_items);
+        writer.add("buckets", (uint64_t)num_buckets);
+        writer.add("items_per_bucket", num_buckets ? (double)m_num_items / num_buckets : 0.);
+        writer.add("hits", m_stats.hits);
+        writer.add("inserts", m_stats.inserts);
+        writer.add("replacements", m_stats.replacements);
+        writer.add("bucket_creations", m_stats.bucket_creations);
+        writer.add("bucket_destructions", m_stats.bucket_destructions);
+    }
+
+    item_type *top()
+    {
+        return (m_tail != nil) ? &m_items[m_buckets[m_tail].tail] : NULL;
     }
 
     item_type *back()
     {
-        if (m_root != NULL) {
-            return m_root->head;
-        } else {
-            return NULL;
-        }
+        return (m_root != nil) ? &m_items[m_buckets[m_root].head] : NULL;
     }
 
     item_type *next(item_type *cur)
     {
-        if (cur->prev != NULL) {
-            return cur->prev;
+        if (cur->prev != nil) {
+            return &m_items[cur->prev];
         } else {
-            bucket_t *bucket = cur->parent;
-            if (bucket->prev != NULL) {
-                return bucket->prev->tail;
-            } else {
-                return NULL;
+            uint32_t prev = m_buckets[cur->parent].prev;
+            return (prev != nil) ? &m_items[m_buckets[prev].tail] : NULL;
+        }
+    }
+
+    /**
+     * Visits the k items with the largest counts.
+     *  The items are visited in the same order as top() and next(). The
+     *  query neither modifies the summary nor allocates memory, and takes
+     *  O(k) time.
+     *  @param  k       The maximum number of items to visit.
+     *  @param  visit   The function receiving an item (const item_type&).
+     *  @return size_t  The number of visited items.
+     */
+    template <class visitor_type>
+    size_t top_k(size_t k, visitor_type visit) const
+    {
+        size_t n = 0;
+        for (uint32_t b = m_tail;b != nil && n < k;b = m_buckets[b].prev) {
+            for (uint32_t i = m_buckets[b].tail;i != nil && n < k;i = m_items[i].prev) {
+                visit(m_items[i]);
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    /**
+     * Visits the items whose counts are no smaller than a threshold.
+     *  The items are visited in the descending order of their counts, in
+     *  O(number of visited items) time without modifying the summary.
+     *  @param  threshold   The minimum count of items to visit.
+     *  @param  visit       The function receiving an item (const item_type&).
+     *  @return size_t      The number of visited items.
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        size_t n = 0;
+        for (uint32_t b = m_tail;b != nil && threshold <= m_buckets[b].count;b = m_buckets[b].prev) {
+            for (uint32_t i = m_buckets[b].tail;i != nil;i = m_items[i].prev) {
+                visit(m_items[i]);
+                ++n;
             }
         }
+        return n;
     }
 
 protected:
-    void detach_item(item_type *item)
+    /// An item with its merged count.
+    struct entry_t
+    {
+        const item_type *item;
+        count_type count;
+        count_type eps;
+    };
+
+    count_type min_count() const
     {
-        item_type *prev = item->prev;
-        item_type *next = item->next;
-        bucket_t *parent = item->parent;
-        if (parent->head == item) {
-            parent->head = next;
+        return (m_num_items < (size_t)m_m || m_root == nil) ? 0 : m_buckets[m_root].count;
+    }
+
+    const item_type *find(const key_view& key, uint32_t hash) const
+    {
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].key == key;
+        });
+        return (i != keyindex::npos) ? &m_items[i] : NULL;
+    }
+
+    /**
+     * Appends an item whose count is no smaller than those of the others.
+     *  @param  last    The last bucket, updated by this function.
+     */
+    void push_item(
+        uint32_t& last,
+        const key_view& key,
+        uint32_t hash,
+        count_type count,
+        count_type eps
+        )
+    {
+        assert(m_num_items < m_items.size());
+        uint32_t i = (uint32_t)m_num_items++;
+        item_type& item = m_items[i];
+        item.key = key;
+        item.hash = hash;
+        item.eps = eps;
+        link_item(last, i, count);
+        m_keys.insert(hash, i);
+    }
+
+    /**
+     * Links an item whose count is no smaller than those of the others.
+     *  @param  last    The last bucket, updated by this function.
+     */
+    void link_item(uint32_t& last, uint32_t i, count_type count)
+    {
+        if (last == nil || m_buckets[last].count != count) {
+            uint32_t bucket = acquire_bucket(count);
+            if (last != nil) {
+                insert_bucket(last, bucket);
+            } else {
+                insert_root_bucket(bucket);
+            }
+            last = bucket;
+        }
+        m_items[i].count = count;
+        append_item(last, i);
+    }
+
+    uint32_t acquire_bucket(count_type count)
+    {
+        uint32_t b = m_free;
+        assert(b != nil);
+        bucket_t& bucket = m_buckets[b];
+        m_free = bucket.next;
+        bucket.count = count;
+        bucket.head = nil;
+        bucket.tail = nil;
+        bucket.prev = nil;
+        bucket.next = nil;
+        return b;
+    }
+
+    void release_bucket(uint32_t b)
+    {
+        m_buckets[b].next = m_free;
+        m_free = b;
+    }
+
+    void detach_item(uint32_t i)
+    {
+        item_type& item = m_items[i];
+        bucket_t& parent = m_buckets[item.parent];
+        if (parent.head == i) {
+            parent.head = item.next;
         }
-        if (parent->tail == item) {
-            parent->tail = prev;
+        if (parent.tail == i) {
+            parent.tail = item.prev;
         }
-        if (prev != NULL) {
-            prev->next = next;
+        if (item.prev != nil) {
+            m_items[item.prev].next = item.next;
         }
-        if (next != NULL) {
-            next->prev = prev;
+        if (item.next != nil) {
+            m_items[item.next].prev = item.prev;
         }
-        item->parent = NULL;
-        item->prev = NULL;
-        item->next = NULL;
+        item.parent = nil;
+        item.prev = nil;
+        item.next = nil;
     }
 
-    void append_item(bucket_t *parent, item_type *item)
+    void append_item(uint32_t b, uint32_t i)
     {
-        item_type *head = parent->head;
-        item_type *tail = parent->tail;
-        if (tail == NULL) {
-            item->prev = NULL;
-            item->next = NULL;
-            parent->head = item;
+        bucket_t& parent = m_buckets[b];
+        item_type& item = m_items[i];
+        if (parent.tail == nil) {
+            item.prev = nil;
+            item.next = nil;
+            parent.head = i;
         } else {
-            tail->next = item;
-            item->prev = tail;
-            item->next = NULL;
+            m_items[parent.tail].next = i;
+            item.prev = parent.tail;
+            item.next = nil;
         }
-        item->parent = parent;
-        parent->tail = item;
+        item.parent = b;
+        parent.tail = i;
     }
 
-    void insert_bucket(bucket_t *first, bucket_t *second)
+    void insert_root_bucket(uint32_t b)
     {
-        bucket_t *next = first->next;
-        if (first != NULL) {
-            second->next = next;
-            first->next = second;
-            second->prev = first;
-            if (next != NULL) {
-                next->prev = second;
-            }
+        m_buckets[b].next = m_root;
+        if (m_root != nil) {
+            m_buckets[m_root].prev = b;
         } else {
-            m_root = second;
-            second->prev = NULL;
-            second->next = NULL;
+            m_tail = b;
         }
+        m_root = b;
+        index_bucket(b);
     }
 
-    void erase_bucket(bucket_t *bucket)
+    void insert_bucket(uint32_t first, uint32_t second)
     {
-        bucket_t *prev = bucket->prev;
-        bucket_t *next = bucket->next;
-        if (prev != NULL) {
-            prev->next = next;
+        uint32_t next = m_buckets[first].next;
+        m_buckets[second].next = next;
+        m_buckets[second].prev = first;
+        m_buckets[first].next = second;
+        if (next != nil) {
+            m_buckets[next].prev = second;
+        } else {
+            m_tail = second;
         }
-        if (next != NULL) {
-            next->prev = prev;
+        index_bucket(second);
+    }
+
+    void erase_bucket(uint32_t b)
+    {
+        if (m_indexed) {
+            m_bucket_index.erase(m_bucket_entries[b]);
+        }
+        uint32_t prev = m_buckets[b].prev;
+        uint32_t next = m_buckets[b].next;
+        if (prev != nil) {
+            m_buckets[prev].next = next;
         }
-        if (m_root == bucket) {
+        if (next != nil) {
+            m_buckets[next].prev = prev;
+        }
+        if (m_root == b) {
             m_root = next;
         }
+        if (m_tail == b) {
+            m_tail = prev;
+        }
     }
 };
 
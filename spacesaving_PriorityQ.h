@@ -28,15 +28,25 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-//#ifndef __SPACESAVING_H__
-//#define __SPACESAVING_H__
+#ifndef __SPACESAVING_PRIORITYQ_H__
+#define __SPACESAVING_PRIORITYQ_H__
 
-#include <unordered_map>
+#include <algorithm>
+#include <cassert>
+#include <iostream>
 #include <vector>
-#include <time.h>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "snapshot.h"
+#include "stats.h"
 
 /**
  * Space-saving algorithm.
+ *  The counters are kept in a pool of items, and a 4-ary min-heap orders
+ *  the positions of the items in the pool by their counts. Every item
+ *  stores its position in the heap, so that an update finds the item
+ *  through the key index and sifts it without copying or rehashing keys.
  *  @param  key_tmpl        Key type.
  *  @param  count_tmpl      Count type.
  */
@@ -51,15 +61,21 @@ public:
     typedef count_tmpl count_type;
     /// This class.
     typedef spacesaving_PriorityQ<key_tmpl, count_tmpl> this_type;
+    /// The type for looking up a key (e.g., std::string_view for strings).
+    typedef typename key_traits<key_tmpl>::view_type key_view;
 	
 public:
 	class item_type
 	{
+        friend class spacesaving_PriorityQ<key_tmpl, count_tmpl>;
+
 	protected:
 		key_type key;       ///< The key
+        uint32_t hash;      ///< The hash value of the key.
         count_type eps;     ///< Epsilon (maximum overestimation of the count)
         count_type count;   ///< Item count.
-		clock_t time;
+		uint64_t time;      ///< Logical time of the last update (for tie-breaking).
+		uint32_t pos;       ///< The position of the item in the heap.
 	
 	public:
 		
@@ -68,7 +84,7 @@ public:
          *  @param  e       The epsilon value.
          */
         item_type()
-		: eps(0), count(0)
+		: hash(0), eps(0), count(0), time(0), pos(0)
         {
         }
 		
@@ -77,9 +93,10 @@ public:
          *  @param  key     The key.
          *  @param  e       The epsilon value.
 		 *  @param  c		the count.
+		 *  @param  t		the logical time.
          */
-        item_type(const key_type& k, count_type e=0, count_type c=0)
-		: key(k), eps(e), count(c), time(clock())
+        item_type(const key_type& k, uint32_t h, count_type e=0, count_type c=0, uint64_t t=0)
+		: key(k), hash(h), eps(e), count(c), time(t), pos(0)
         {
         }
 		
@@ -91,6 +108,15 @@ public:
         {
             return this->key;
         }
+
+        /**
+         * Gets the hash value of the key.
+         *  @return uint32_t    the hash value.
+         */
+        uint32_t get_hash() const
+        {
+            return this->hash;
+        }
 		
         /**
          * Gets the count of the key.
@@ -111,36 +137,54 @@ public:
         }
 		
 		/**
-         * Gets the time of the key (when inserted)
-         *  @return clock_t  the time.
+         * Gets the logical time of the last update of the key.
+         *  @return uint64_t  the time.
          */
-		clock_t get_time() const
+		uint64_t get_time() const
 		{
 			return this->time;
 		}
 		
 		/**
-         * Gets the time of the key (when inserted)
+         * Adds a frequency to the count.
+         *  @param  freq    the frequency.
+         *  @param  t       the logical time of the update.
          */
-		void add_count(count_type freq)
+		void add_count(count_type freq, uint64_t t)
 		{
 			count+=freq;
-			time=clock();
+			time=t;
 		}
 	};
 
     
 protected: //protected param
-    /// A mapping type: key -> *item.
-    typedef std::unordered_map<key_type, int> keys_t;
-    /// The mapping object: key -> *item.
-    keys_t m_keys;
+    /// Key hashing.
+    typedef key_traits<key_type> traits_t;
+    /// The mapping object: key -> position of the item in the pool.
+    keyindex m_keys;
     /// The total frequency.
     count_type m_n;
     /// The maximum number of counters.
     count_type m_m;
-	/// heap
-	std::vector<item_type*> heap;
+	/// The pool of items (an item never moves while it is counted).
+	std::vector<item_type> m_items;
+	/// The 4-ary min-heap of the positions of items in the pool.
+	std::vector<uint32_t> heap;
+	/// The logical clock, incremented on every update.
+	uint64_t m_time;
+	/// The scratch space for sorting items in queries.
+	mutable std::vector<uint32_t> m_order;
+
+	/**
+	 * Statistics of the updates (counted if USE_COUNTER_STATS is defined).
+	 */
+	struct stats_t
+	{
+		uint64_t updates;		///< Updates.
+		uint64_t sift_steps;	///< Levels moved by items in the heap.
+		uint64_t max_sift;		///< The maximum levels moved in an update.
+	} m_stats;
 	
 
 public:
@@ -148,8 +192,11 @@ public:
      * Constructs an object.
      *  @param  m       The maximum number of counters.
      */
-    spacesaving_PriorityQ(count_type m=4) : m_n(0), m_m(m)
+    spacesaving_PriorityQ(count_type m=4) : m_keys(m), m_n(0), m_m(m), m_time(0), m_stats()
     {
+		m_items.reserve((size_t)m);
+		heap.reserve((size_t)m);
+		m_order.reserve((size_t)m);
     }
 
     /**
@@ -160,123 +207,477 @@ public:
     }
 
 protected:
-    void addFreq(int& item_id, const count_type& freq)
+    void addFreq(uint32_t i, const count_type& freq)
     {
-		heap[item_id]->add_count(freq);
-		downheap(item_id);
+		m_items[i].add_count(freq, ++m_time);
+		downheap(m_items[i].pos);
     }
 	
-	void push(const key_type& key, const count_type& freq){
-		item_type *item = new item_type(key,0,freq);
-		heap.push_back(item);
-		int item_id = m_keys.size(); 
-		m_keys[key] = item_id;
-		upheap(item_id);
+	template <class key_arg>
+	void push(const key_arg& key, uint32_t hash, const count_type& freq, const count_type& eps=0){
+		assert(m_items.size() < (size_t)m_m);
+		uint32_t i = (uint32_t)m_items.size();
+		m_items.push_back(item_type(key_type(key),hash,eps,freq,++m_time));
+		m_items[i].pos = (uint32_t)heap.size();
+		heap.push_back(i);
+		m_keys.insert(hash, i);
+		upheap(m_items[i].pos);
 	}
 	
-	void popandpush(const key_type& key, const count_type& freq){
-	
-		key_type frontkey = heap[0]->get_key();
-		count_type frontcount = heap[0]->get_count();
-		//replace m_keys
-		m_keys.erase(frontkey);
-		m_keys[key] = 0;
-		//replace heap 0
-		item_type *item = new item_type(key,frontcount,freq+frontcount);
-		heap[0] = item;
+	void popandpush(const key_view& key, uint32_t hash, const count_type& freq){
+		// Reuse the item with the minimum count for the new key.
+		uint32_t i = heap[0];
+		item_type& item = m_items[i];
+		m_keys.erase(item.hash, i);
+		m_keys.insert(hash, i);
+		item.key = key;
+		item.hash = hash;
+		item.eps = item.count;
+		item.add_count(freq, ++m_time);
 		downheap(0);
 	}
 
 public:
-    void append(const key_type& key, const count_type& freq )
+	/**
+	 * Counts occurrences of a key.
+	 *  @param  key     The key.
+	 *  @param  freq    The number of occurrences.
+	 *  @return bool    \c true if a counter was assigned to the key (i.e.,
+	 *                  the key was not counted before this call).
+	 */
+    bool append(const key_view& key, const count_type& freq = 1)
     {
-        typename keys_t::iterator it = m_keys.find(key);  
-		if (it != m_keys.end()) {
+        return update(key, traits_t::hash(key), freq);
+    }
+
+	/**
+	 * Counts occurrences of a batch of keys.
+	 *  This is equivalent to calling append() for every key in order, but
+	 *  it hashes the keys in advance and prefetches the slots of the key
+	 *  index and the items a few keys ahead, so that the cache misses of
+	 *  successive keys overlap.
+	 *  @param  keys    The array of keys.
+	 *  @param  n       The number of keys.
+	 *  @param  freqs   The array of the numbers of occurrences (NULL for
+	 *                  one occurrence per key).
+	 */
+	void append_batch(const key_view* keys, size_t n, const count_type* freqs = NULL)
+	{
+		uint32_t hashes[batch_size];
+		for (size_t offset = 0;offset < n;offset += batch_size) {
+			size_t size = std::min(batch_size, n - offset);
+			const key_view *batch = keys + offset;
+			for (size_t i = 0;i < size;++i) {
+				hashes[i] = traits_t::hash(batch[i]);
+			}
+			for (size_t i = 0;i < size && i < prefetch_distance;++i) {
+				m_keys.prefetch(hashes[i]);
+			}
+			for (size_t i = 0;i < size;++i) {
+				if (i + prefetch_distance < size) {
+					m_keys.prefetch(hashes[i + prefetch_distance]);
+				}
+				if (i + prefetch_distance / 2 < size) {
+					uint32_t j = m_keys.peek(hashes[i + prefetch_distance / 2]);
+					if (j != keyindex::npos) {
+						KEYINDEX_PREFETCH(&m_items[j]);
+					}
+				}
+				update(batch[i], hashes[i], (freqs != NULL) ? freqs[offset + i] : 1);
+			}
+		}
+	}
+
+protected:
+	/// The number of keys hashed in advance by append_batch().
+	static constexpr size_t batch_size = 64;
+	/// The distance of prefetching in append_batch().
+	static constexpr size_t prefetch_distance = 8;
+
+	bool update(const key_view& key, uint32_t hash, const count_type& freq)
+	{
+		if (freq == 0) {
+			return false;
+		}
+        uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+            return m_items[j].get_key() == key;
+        });
+        m_n += freq;
+		COUNTER_STATS(++m_stats.updates);
+		if (i != keyindex::npos) {
             // add freq to the counter
-            this->addFreq(it->second, freq);
-			//this->addFreq(m_keys[key],freq);
-        } else if ((count_type)m_keys.size() < m_m) {
+            this->addFreq(i, freq);
+            return false;
+        } else if (m_keys.size() < (size_t)m_m) {
             // push queue
-			this->push(key,freq);
+			this->push(key,hash,freq);
         } else {
             // pop queue.front() and push
-			this->popandpush(key,freq);
+			this->popandpush(key,hash,freq);
         }
-        ++m_n;
+        return true;
     }
-	
-	
-protected:
-	void downheap(int item_id)
+
+public:
+	/**
+	 * Merges another summary into this summary.
+	 *  This implements the same combine step as spacesaving::merge(): a
+	 *  key missing in a summary is regarded to have the minimum count of
+	 *  the summary as its count and epsilon, the counts and epsilons are
+	 *  added, and the m items with the largest counts are kept.
+	 *  @param  other   The summary to be merged into this summary.
+	 */
+	void merge(const spacesaving_PriorityQ& other)
 	{
-		int c = item_id*2+1, sz = heap.size();
-		if(c >= sz) return;
-		if(c+1 < sz){
-			count_type cnt1=heap[c]->get_count(), cnt2=heap[c+1]->get_count();
-			if( cnt1 > cnt2) c++;
-			if( cnt1 == cnt2 and heap[c]->get_time() > heap[c+1]->get_time()) c++;
+		count_type min1 = this->min_count(), min2 = other.min_count();
+		std::vector<item_type> items;
+		items.reserve(m_items.size() + other.m_items.size());
+
+		for (size_t i = 0;i < m_items.size();++i) {
+			const item_type *item = &m_items[i];
+			const item_type *x = other.find(item->get_key(), item->get_hash());
+			items.push_back(item_type(
+				item->get_key(), item->get_hash(),
+				item->get_epsilon() + (x != NULL ? x->get_epsilon() : min2),
+				item->get_count() + (x != NULL ? x->get_count() : min2)
+				));
 		}
-		count_type cnt1=heap[item_id]->get_count(), cnt2=heap[c]->get_count();
-		if(cnt1 < cnt2) return;
-		//if(cnt1 == cnt2 && (heap[item_id]->get_epsilon() > heap[c]->get_epsilon())) return; //sort by epsilon
-		if(cnt1 == cnt2 and heap[item_id]->get_time() <= heap[c]->get_time()) { // return; //sort by time
-		std::cout << heap[item_id]->get_time() << " , child:" << heap[c]->get_time() <<  std::endl;
-		std::cout<<"return"<<std::endl;
-		return;
+		for (size_t i = 0;i < other.m_items.size();++i) {
+			const item_type *x = &other.m_items[i];
+			if (this->find(x->get_key(), x->get_hash()) == NULL) {
+				items.push_back(item_type(
+					x->get_key(), x->get_hash(),
+					x->get_epsilon() + min1,
+					x->get_count() + min1
+					));
+			}
 		}
-		
-		//swap
-		key_type s1=heap[item_id]->get_key(), s2=heap[c]->get_key();
-		std::swap(m_keys[s1],m_keys[s2]);
-		std::swap(heap[item_id],heap[c]);
-		downheap(c);
+
+		std::stable_sort(items.begin(), items.end(), [](const item_type& x, const item_type& y) {
+			return x.get_count() > y.get_count();
+		});
+		if (items.size() > (size_t)m_m) {
+			items.resize((size_t)m_m);
+		}
+
+		count_type n = m_n + other.m_n;
+		this->clear();
+		for (size_t i = 0;i < items.size();++i) {
+			const item_type& item = items[i];
+			this->push(item.get_key(), item.get_hash(), item.get_count(), item.get_epsilon());
+		}
+		m_n = n;
+
+		m_stats.updates += other.m_stats.updates;
+		m_stats.sift_steps += other.m_stats.sift_steps;
+		m_stats.max_sift = std::max(m_stats.max_sift, other.m_stats.max_sift);
 	}
-	
-	void upheap(int item_id)
+
+	/**
+	 * Saves the summary to a snapshot file.
+	 *  The snapshot stores the items in the heap order (counts, epsilons,
+	 *  times, hash values, and keys) and the slots of the key index, which
+	 *  map the keys to the heap positions.
+	 *  @param  path    The path to the snapshot file.
+	 *  @throws         std::runtime_error
+	 */
+	void save(const std::string& path) const
 	{
-		if(item_id==0) return;
-		int p=(item_id-1)/2;
-		count_type cnt1=heap[item_id]->get_count(), cnt2=heap[p]->get_count();
-		if(cnt1 > cnt2) return;
-		//if(cnt1 == cnt2 && (heap[item_id]->get_epsilon() < heap[p]->get_epsilon())) return;
-		if(cnt1 == cnt2 and heap[item_id]->get_time() >= heap[p]->get_time()) return;
-		
-		//swap
-		key_type s1=heap[item_id]->get_key(), s2=heap[p]->get_key();
-		std::swap(m_keys[s1],m_keys[s2]);
-		std::swap(heap[item_id],heap[p]);
-		upheap(p);
+		size_t n = heap.size();
+		std::vector<uint32_t> hashes(n);
+		std::vector<count_type> counts(n), eps(n);
+		std::vector<uint64_t> times(n);
+		for (size_t i = 0;i < n;++i) {
+			const item_type& item = m_items[heap[i]];
+			counts[i] = item.count;
+			eps[i] = item.eps;
+			times[i] = item.time;
+			hashes[i] = item.hash;
+		}
+		std::vector<uint32_t> slots(m_keys.data(), m_keys.data() + 2 * m_keys.num_slots());
+		for (size_t i = 0;i < m_keys.num_slots();++i) {
+			if (slots[2*i+1] != keyindex::npos) {
+				slots[2*i+1] = m_items[slots[2*i+1]].pos;
+			}
+		}
+
+		snapshot_writer writer(path, SNAPSHOT_SPACESAVING_PRIORITYQ, snapshot_key<key_type>::size, sizeof(count_type));
+		writer.put(m_n);
+		writer.put(m_m);
+		writer.put(n);
+		writer.put_array(counts.data(), n);
+		writer.put_array(eps.data(), n);
+		writer.put_array(times.data(), n);
+		writer.put_array(hashes.data(), n);
+		snapshot_put_keys<key_type>(writer, heap.begin(), n, [this](uint32_t i) -> const key_type& {
+			return m_items[i].key;
+		});
+		writer.put(m_keys.num_slots());
+		writer.put_array(slots.data(), slots.size());
+		writer.close();
+	}
+
+	/**
+	 * Loads the summary from a snapshot file.
+	 *  This replaces the current state, including the number of counters.
+	 *  The items are placed in the pool in the order of the snapshot, so
+	 *  that the slots of the key index can be copied as they are.
+	 *  @param  path    The path to the snapshot file.
+	 *  @throws         std::runtime_error
+	 */
+	void load(const std::string& path)
+	{
+		snapshot_reader reader(path, SNAPSHOT_SPACESAVING_PRIORITYQ, snapshot_key<key_type>::size, sizeof(count_type));
+		count_type total = (count_type)reader.get();
+		count_type m = (count_type)reader.get();
+		size_t n = (size_t)reader.get();
+		if (m < 1 || n > (size_t)m) {
+			reader.fail();
+		}
+
+		this->clear();
+		if (m != m_m) {
+			m_m = m;
+			m_keys = keyindex(m);
+			m_items.reserve((size_t)m);
+			heap.reserve((size_t)m);
+			m_order.reserve((size_t)m);
+		}
+
+		const count_type *counts = reader.get_array<count_type>(n);
+		const count_type *eps = reader.get_array<count_type>(n);
+		const uint64_t *times = reader.get_array<uint64_t>(n);
+		const uint32_t *hashes = reader.get_array<uint32_t>(n);
+		m_items.resize(n);
+		heap.resize(n);
+		for (size_t i = 0;i < n;++i) {
+			item_type& item = m_items[i];
+			item.count = counts[i];
+			item.eps = eps[i];
+			item.time = times[i];
+			item.hash = hashes[i];
+			item.pos = (uint32_t)i;
+			heap[i] = (uint32_t)i;
+			m_time = std::max(m_time, times[i]);
+		}
+		snapshot_get_keys(reader, n, [&](size_t i, std::string_view bytes) {
+			return snapshot_key<key_type>::assign(m_items[i].key, bytes);
+		});
+
+		if ((size_t)reader.get() != m_keys.num_slots()) {
+			reader.fail();
+		}
+		const uint32_t *slots = reader.get_array<uint32_t>(2 * m_keys.num_slots());
+		size_t size = 0;
+		for (size_t i = 0;i < m_keys.num_slots();++i) {
+			if (slots[2*i+1] != keyindex::npos) {
+				if (n <= slots[2*i+1]) {
+					reader.fail();
+				}
+				++size;
+			}
+		}
+		if (size != n) {
+			reader.fail();
+		}
+		m_keys.assign(slots, n);
+		m_n = total;
+
+		// Restore the heap order if the snapshot was not a 4-ary heap.
+		for (size_t i = (n + 2) / 4;0 < i;--i) {
+			downheap((uint32_t)(i - 1));
+		}
+	}
+
+	/**
+	 * Multiplies the counts and epsilons of all items by a positive factor.
+	 *  The order of the items does not change, and so does the heap.
+	 *  @param  factor  The factor.
+	 */
+	void scale(count_type factor)
+	{
+		for (size_t i = 0;i < m_items.size();++i) {
+			m_items[i].count *= factor;
+			m_items[i].eps *= factor;
+		}
+		m_n *= factor;
+	}
+
+	/**
+	 * Removes all counters.
+	 */
+	void clear()
+	{
+		m_items.clear();
+		heap.clear();
+		m_keys.clear();
+		m_n = 0;
+		m_time = 0;
 	}
 
 protected:
-	item_type pop(){ //for show result
-		int sz=heap.size();
-		item_type ret = *heap[0];
-		heap[0]=heap[sz-1];
-		heap.erase(heap.end()-1);
-		downheap(0);
-		return ret;
+	count_type min_count() const
+	{
+		return (heap.size() < (size_t)m_m || heap.empty()) ? 0 : m_items[heap[0]].get_count();
+	}
+
+	const item_type *find(const key_view& key, uint32_t hash) const
+	{
+		uint32_t i = m_keys.find(hash, [&](uint32_t j) {
+			return m_items[j].get_key() == key;
+		});
+		return (i != keyindex::npos) ? &m_items[i] : NULL;
+	}
+
+protected:
+	/**
+	 * Tests if an item should be closer to the root of the heap.
+	 *  Items with smaller counts come first; ties are broken by the time of
+	 *  the last update, so that the least recently updated item is evicted.
+	 */
+	bool precedes(uint32_t i, uint32_t j) const
+	{
+		const item_type& x = m_items[i];
+		const item_type& y = m_items[j];
+		return x.count < y.count || (x.count == y.count && x.time < y.time);
+	}
+
+	void downheap(uint32_t pos)
+	{
+		uint32_t i = heap[pos], sz = (uint32_t)heap.size();
+		COUNTER_STATS(uint64_t steps = 0);
+		for (;;) {
+			uint32_t c = pos * 4 + 1;
+			if (c >= sz) break;
+			// Find the smallest of the (up to) four children.
+			uint32_t last = std::min(c + 4, sz);
+			for (uint32_t k = c + 1;k < last;++k) {
+				if (precedes(heap[k], heap[c])) c = k;
+			}
+			if (!precedes(heap[c], i)) break;
+			// Move the child up into the hole.
+			heap[pos] = heap[c];
+			m_items[heap[pos]].pos = pos;
+			pos = c;
+			COUNTER_STATS(++steps);
+		}
+		heap[pos] = i;
+		m_items[i].pos = pos;
+		COUNTER_STATS(count_sift(steps));
+	}
+	
+	void upheap(uint32_t pos)
+	{
+		uint32_t i = heap[pos];
+		COUNTER_STATS(uint64_t steps = 0);
+		while (0 < pos) {
+			uint32_t p = (pos - 1) / 4;
+			if (!precedes(i, heap[p])) break;
+			// Move the parent down into the hole.
+			heap[pos] = heap[p];
+			m_items[heap[pos]].pos = pos;
+			pos = p;
+			COUNTER_STATS(++steps);
+		}
+		heap[pos] = i;
+		m_items[i].pos = pos;
+		COUNTER_STATS(count_sift(steps));
+	}
+
+	void count_sift(uint64_t steps)
+	{
+		m_stats.sift_steps += steps;
+		m_stats.max_sift = std::max(m_stats.max_sift, steps);
 	}
 
 public:
 	void debug(){
 		std::cout<<"****now heap****"<<std::endl;
-		for(int i=0;i<heap.size();i++){
-			std::cout<<heap[i]->get_key()<<":"<<heap[i]->get_count()<<"    eps:"<<heap[i]->get_epsilon()<<std::endl;
+		for(size_t i=0;i<heap.size();i++){
+			const item_type& item = m_items[heap[i]];
+			std::cout<<item.get_key()<<":"<<item.get_count()<<"    eps:"<<item.get_epsilon()<<std::endl;
 		}
 	}
 	
-	void showresult(){
-		std::vector<item_type> result; 
-		item_type item;
-		while(!heap.empty()){
-			item = this->pop();
-			result.push_back(item);
+	/**
+	 * Visits the k items with the largest counts.
+	 *  The items are visited in the descending order of their counts (the
+	 *  most recently updated first for ties). The query does not modify
+	 *  the summary and does not allocate memory; it sorts the positions of
+	 *  the items in a scratch space, which must not be shared by concurrent
+	 *  queries.
+	 *  @param  k       The maximum number of items to visit.
+	 *  @param  visit   The function receiving an item (const item_type&).
+	 *  @return size_t  The number of visited items.
+	 */
+	template <class visitor_type>
+	size_t top_k(size_t k, visitor_type visit) const
+	{
+		k = std::min(k, heap.size());
+		m_order.assign(heap.begin(), heap.end());
+		std::partial_sort(m_order.begin(), m_order.begin() + k, m_order.end(), [this](uint32_t i, uint32_t j) {
+			return precedes(j, i);
+		});
+		for (size_t i = 0;i < k;++i) {
+			visit(m_items[m_order[i]]);
 		}
-		for(int i=result.size()-1;i>0;i--){
-			std::cout<<result[i].get_key()<<"\t"<<result[i].get_count()<<"\t"<<result[i].get_epsilon()<<std::endl;
+		return k;
+	}
+
+	/**
+	 * Visits the items whose counts are no smaller than a threshold.
+	 *  The items are visited in the same order as top_k().
+	 *  @param  threshold   The minimum count of items to visit.
+	 *  @param  visit       The function receiving an item (const item_type&).
+	 *  @return size_t      The number of visited items.
+	 */
+	template <class visitor_type>
+	size_t items_above(double threshold, visitor_type visit) const
+	{
+		m_order.clear();
+		for (size_t i = 0;i < heap.size();++i) {
+			if (threshold <= m_items[heap[i]].count) {
+				m_order.push_back(heap[i]);
+			}
+		}
+		std::sort(m_order.begin(), m_order.end(), [this](uint32_t i, uint32_t j) {
+			return precedes(j, i);
+		});
+		for (size_t i = 0;i < m_order.size();++i) {
+			visit(m_items[m_order[i]]);
 		}
+		return m_order.size();
+	}
+
+	/**
+	 * Writes the items in the descending order of their counts.
+	 *  @param  os          The output stream.
+	 *  @param  threshold   The minimum count of items to be written.
+	 */
+	void showresult(std::ostream& os = std::cout, double threshold = 0.) const {
+		items_above(threshold, [&os](const item_type& item) {
+			os<<item.get_key()<<"\t"<<item.get_count()<<"\t"<<item.get_epsilon()<<"\n";
+		});
+	}
+
+	count_type total() const
+	{
+		return m_n;
+	}
+
+	/**
+	 * Writes the statistics of the summary.
+	 *  @param  writer  The writer.
+	 */
+	void write_stats(stats_writer& writer) const
+	{
+		writer.add("counters", (uint64_t)m_m);
+		writer.add("items", (uint64_t)heap.size());
+		writer.add("updates", m_stats.updates);
+		writer.add("sift_steps", m_stats.sift_steps);
+		writer.add("sift_depth_per_update", m_stats.updates ? (double)m_stats.sift_steps / m_stats.updates : 0.);
+		writer.add("max_sift_depth", m_stats.max_sift);
 	}
 };
 
-//#endif/*__SPACESAVING_H__*/
+#endif/*__SPACESAVING_PRIORITYQ_H__*/
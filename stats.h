@@ -0,0 +1,230 @@
+/*
+ *      Statistics of counters and runs (--stats).
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * The counters of the hot paths (e.g., hits and replacements of
+ * spacesaving) are compiled in only when USE_COUNTER_STATS is defined:
+ *  $ g++ -O2 -std=c++17 -DUSE_COUNTER_STATS -o approxcounter main.cpp
+ * Otherwise, COUNTER_STATS() expands to nothing and the counters stay zero.
+ */
+#ifdef  USE_COUNTER_STATS
+#define COUNTER_STATS(statement)    statement
+#define COUNTER_STATS_ENABLED       true
+#else
+#define COUNTER_STATS(statement)
+#define COUNTER_STATS_ENABLED       false
+#endif/*USE_COUNTER_STATS*/
+
+/**
+ * A writer of statistics as a JSON object.
+ *  Members are written in the order of the calls; begin() and end() open
+ *  and close a nested object.
+ */
+class stats_writer
+{
+protected:
+    /// The output stream.
+    std::ostream& m_os;
+    /// Whether the current (innermost) object has no member yet.
+    std::vector<bool> m_empty;
+
+public:
+    /**
+     * Constructs a writer and opens the outermost object.
+     *  @param  os      The output stream.
+     */
+    stats_writer(std::ostream& os) : m_os(os)
+    {
+        m_os << '{';
+        m_empty.push_back(true);
+    }
+
+    /**
+     * Closes all open objects.
+     */
+    virtual ~stats_writer()
+    {
+        while (!m_empty.empty()) {
+            end();
+        }
+        m_os << std::endl;
+    }
+
+    /**
+     * Opens a nested object.
+     *  @param  name    The name of the object.
+     */
+    void begin(const char *name)
+    {
+        key(name);
+        m_os << '{';
+        m_empty.push_back(true);
+    }
+
+    /**
+     * Closes the current object.
+     */
+    void end()
+    {
+        m_os << '}';
+        m_empty.pop_back();
+    }
+
+    void add(const char *name, std::string_view value)
+    {
+        key(name);
+        put_string(value);
+    }
+
+    void add(const char *name, const char *value)
+    {
+        add(name, std::string_view(value));
+    }
+
+    void add(const char *name, bool value)
+    {
+        key(name);
+        m_os << (value ? "true" : "false");
+    }
+
+    void add(const char *name, double value)
+    {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+        key(name);
+        m_os << buffer;
+    }
+
+    template <class integer_type>
+    typename std::enable_if<std::is_integral<integer_type>::value>::type
+    add(const char *name, integer_type value)
+    {
+        key(name);
+        m_os << +value;
+    }
+
+protected:
+    void key(const char *name)
+    {
+        if (!m_empty.back()) {
+            m_os << ',';
+        }
+        m_empty.back() = false;
+        put_string(name);
+        m_os << ':';
+    }
+
+    void put_string(std::string_view str)
+    {
+        m_os << '"';
+        for (size_t i = 0;i < str.size();++i) {
+            char c = str[i];
+            if (c == '"' || c == '\\') {
+                m_os << '\\' << c;
+            } else if ((unsigned char)c < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                m_os << buffer;
+            } else {
+                m_os << c;
+            }
+        }
+        m_os << '"';
+    }
+};
+
+/**
+ * Detects counters providing write_stats(stats_writer&).
+ */
+template <class counter_type, class = void>
+struct has_stats : std::false_type
+{
+};
+
+template <class counter_type>
+struct has_stats<counter_type, std::void_t<decltype(
+    std::declval<const counter_type&>().write_stats(std::declval<stats_writer&>()))> >
+    : std::true_type
+{
+};
+
+/**
+ * Writes the statistics of a counter, if any.
+ *  @param  writer  The writer.
+ *  @param  counter The counter.
+ */
+template <class counter_type>
+void write_counter_stats(stats_writer& writer, const counter_type& counter)
+{
+    if constexpr (has_stats<counter_type>::value) {
+        counter.write_stats(writer);
+    }
+}
+
+/**
+ * A stopwatch measuring the wall-clock time of phases.
+ */
+class stopwatch
+{
+protected:
+    std::chrono::steady_clock::time_point m_last;
+
+public:
+    stopwatch() : m_last(std::chrono::steady_clock::now())
+    {
+    }
+
+    /**
+     * Gets the time elapsed since the construction or the previous lap.
+     *  @return double  The elapsed time in seconds.
+     */
+    double lap()
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double sec = std::chrono::duration<double>(now - m_last).count();
+        m_last = now;
+        return sec;
+    }
+};
+
+#endif/*__STATS_H__*/
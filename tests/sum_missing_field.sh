@@ -0,0 +1,22 @@
+#!/bin/sh
+# Regression test: with --sum input, a line without the key field is
+# credited to the empty key, never to the key of the previous line.
+#  usage: tests/sum_missing_field.sh path/to/approxcounter
+
+bin=${1:-./approxcounter}
+expected=$(printf 'bar\t4\t0\n\t2\t0\nfoo\t1\t0')
+status=0
+
+for algorithm in spacesaving-sum spacesaving-heap-sum; do
+    for threads in 1 2; do
+        actual=$(printf '1\tfoo\n2\n4\tbar\n' | "$bin" -a $algorithm -t 2 -f 1 -T $threads)
+        if [ "$actual" != "$expected" ]; then
+            echo "FAIL: -a $algorithm -T $threads"
+            echo "$actual"
+            status=1
+        fi
+    done
+done
+
+[ $status -eq 0 ] && echo "OK"
+exit $status
@@ -28,7 +28,17 @@
 #ifndef __TOKENIZE_H__
 #define __TOKENIZE_H__
 
+#include <cstring>
+#include <limits>
 #include <string>
+#include <string_view>
+#include <stdint.h>
+
+#if     defined(__AVX2__)
+#include <immintrin.h>
+#elif   defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 template <class char_type>
 class basic_tokenizer
@@ -229,4 +239,218 @@ public:
 
 typedef basic_tokenizer<char> tokenizer;
 
+
+/**
+ * Tokenizer returning the fields of a line as views of the line.
+ *  Unlike tokenizer, this class neither copies the line nor the fields,
+ *  and it can skip to a field without scanning the preceding fields one
+ *  by one: separators are located by comparing 32 (AVX2) or 16 (SSE2)
+ *  bytes at a time, and a block without the wanted separator is skipped
+ *  as a whole. Fields are numbered from one; as with tokenizer, a trailing
+ *  separator does not start an empty field.
+ */
+class field_tokenizer
+{
+protected:
+    const char *m_pos;      ///< The beginning of the current field.
+    const char *m_end;      ///< The end of the line.
+    char m_sep;             ///< The separator.
+    int m_index;            ///< The number of the current field.
+
+public:
+    /**
+     * Constructs a tokenizer.
+     *  @param  line        The line to be tokenized.
+     *  @param  sep         A separator character.
+     */
+    field_tokenizer(std::string_view line, char sep = '\t')
+        : m_pos(line.data()), m_end(line.data() + line.size()), m_sep(sep), m_index(1)
+    {
+    }
+
+    /**
+     * Gets a field.
+     *  Fields must be requested in the ascending order of their numbers
+     *  (the same field may be requested again).
+     *  @param  k           The number of the field (starting from one).
+     *  @param  field       The view of the field.
+     *  @retval bool        \c true if the field exists; \c false otherwise.
+     */
+    bool get(int k, std::string_view& field)
+    {
+        if (k < m_index) {
+            return false;
+        }
+        if (m_index < k) {
+            m_pos = skip(m_pos, m_end, m_sep, (size_t)(k - m_index));
+            m_index = k;
+        }
+        if (m_pos == m_end) {
+            return false;
+        }
+        const char *p = find(m_pos, m_end, m_sep);
+        field = std::string_view(m_pos, p - m_pos);
+        return true;
+    }
+
+    /**
+     * Gets the current field and advances to the next field.
+     *  @param  field       The view of the field.
+     *  @retval bool        \c true if a field was read; \c false at the end.
+     */
+    bool next(std::string_view& field)
+    {
+        if (!get(m_index, field)) {
+            return false;
+        }
+        m_pos += field.size();
+        m_pos += (m_pos != m_end);
+        ++m_index;
+        return true;
+    }
+
+protected:
+    /**
+     * Finds the first separator.
+     *  @retval const char* The pointer to the separator, or end if not found.
+     */
+    static const char *find(const char *p, const char *end, char sep)
+    {
+#if     defined(__AVX2__)
+        const __m256i vsep = _mm256_set1_epi8(sep);
+        for (;32 <= end - p;p += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vsep));
+            if (mask != 0) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+#elif   defined(__SSE2__)
+        const __m128i vsep = _mm_set1_epi8(sep);
+        for (;16 <= end - p;p += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vsep));
+            if (mask != 0) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+#endif
+        const char *q = (const char*)std::memchr(p, sep, end - p);
+        return (q != NULL) ? q : end;
+    }
+
+    /**
+     * Skips n separators.
+     *  @retval const char* The pointer following the n-th separator, or end
+     *                      if the line has fewer separators.
+     */
+    static const char *skip(const char *p, const char *end, char sep, size_t n)
+    {
+#if     defined(__AVX2__)
+        const __m256i vsep = _mm256_set1_epi8(sep);
+        for (;32 <= end - p;p += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vsep));
+            size_t c = (size_t)__builtin_popcount(mask);
+            if (n <= c) {
+                return p + nth_bit(mask, n) + 1;
+            }
+            n -= c;
+        }
+#elif   defined(__SSE2__)
+        const __m128i vsep = _mm_set1_epi8(sep);
+        for (;16 <= end - p;p += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vsep));
+            size_t c = (size_t)__builtin_popcount(mask);
+            if (n <= c) {
+                return p + nth_bit(mask, n) + 1;
+            }
+            n -= c;
+        }
+#endif
+        for (;p != end;++p) {
+            if (*p == sep && --n == 0) {
+                return p + 1;
+            }
+        }
+        return end;
+    }
+
+#if     defined(__AVX2__) || defined(__SSE2__)
+    static int nth_bit(uint32_t mask, size_t n)
+    {
+        // Clear the n-1 lowest set bits.
+        while (1 < n--) {
+            mask &= mask - 1;
+        }
+        return __builtin_ctz(mask);
+    }
+#endif
+};
+
+/**
+ * Converts eight decimal digits into their value.
+ *  @param  chunk       The eight characters loaded in little-endian order.
+ *  @retval bool        \c true if all of the characters are digits.
+ */
+inline bool parse_eight_digits(uint64_t chunk, uint32_t& value)
+{
+    // Every byte must be in '0'...'9' (0x30...0x39).
+    if ((chunk & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL ||
+        ((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL) {
+        return false;
+    }
+    // Combine the digits pairwise: 8 x 1 -> 4 x 2 -> 2 x 4 -> 1 x 8.
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+        (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    value = (uint32_t)chunk;
+    return true;
+}
+
+/**
+ * Parses a non-negative decimal integer.
+ *  The string must consist of digits only (no sign, no spaces), and its
+ *  value must be representable by value_type. Eight digits are converted
+ *  at a time on little-endian platforms.
+ *  @param  str         The string.
+ *  @param  value       The value.
+ *  @retval bool        \c true if the string is a valid number; \c false
+ *                      if it is empty, has other characters, or overflows.
+ */
+template <class value_type>
+bool parse_count(std::string_view str, value_type& value)
+{
+    const char *p = str.data();
+    const char *end = p + str.size();
+    const uint64_t max = (uint64_t)std::numeric_limits<value_type>::max();
+    uint64_t v = 0;
+
+    if (p == end) {
+        return false;
+    }
+#if     defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || defined(_WIN32)
+    for (;8 <= end - p;p += 8) {
+        uint64_t chunk;
+        uint32_t d;
+        std::memcpy(&chunk, p, sizeof(chunk));
+        if (!parse_eight_digits(chunk, d) || max < d || (max - d) / 100000000 < v) {
+            return false;
+        }
+        v = v * 100000000 + d;
+    }
+#endif
+    for (;p != end;++p) {
+        unsigned d = (unsigned char)*p - '0';
+        if (9 < d || (max - d) / 10 < v) {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    value = (value_type)v;
+    return true;
+}
+
 #endif/*__TOKENIZE_H__*/
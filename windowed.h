@@ -0,0 +1,323 @@
+/*
+ *      Sliding-window and time-decayed summaries.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __WINDOWED_H__
+#define __WINDOWED_H__
+
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "keyindex.h"
+#include "spacesaving_PriorityQ.h"
+#include "stats.h"
+
+/**
+ * A summary of the last N updates of a stream.
+ *  The window is divided into E epochs of N/E updates, and a ring holds
+ *  one sub-summary per epoch. When the current epoch is full, the window
+ *  slides by one epoch: the sub-summary of the oldest epoch is replaced
+ *  with an empty one, which costs O(m) regardless of the history. A query
+ *  merges the sub-summaries into a summary of the window; the window thus
+ *  covers between N-N/E and N of the latest updates.
+ *  @param  counter_tmpl    The mergeable summary (e.g., spacesaving).
+ */
+template <class counter_tmpl>
+class windowed
+{
+public:
+    /// The summary of an epoch.
+    typedef counter_tmpl counter_type;
+    /// Key type.
+    typedef typename counter_type::key_type key_type;
+    /// Count type.
+    typedef typename counter_type::count_type count_type;
+    /// The type for looking up a key.
+    typedef typename counter_type::key_view key_view;
+    /// Count item.
+    typedef typename counter_type::item_type item_type;
+
+protected:
+    /// The function returning a new empty sub-summary.
+    std::function<counter_type*()> m_create;
+    /// The ring of the sub-summaries of epochs.
+    std::vector<std::unique_ptr<counter_type> > m_epochs;
+    /// The position of the current epoch in the ring.
+    size_t m_current;
+    /// The number of updates in an epoch.
+    uint64_t m_epoch_size;
+    /// The number of updates in the current epoch.
+    uint64_t m_epoch_updates;
+
+public:
+    /**
+     * Constructs an object.
+     *  @param  window      The number of updates in the window (N).
+     *  @param  num_epochs  The number of epochs in the window (E).
+     *  @param  args        The arguments for constructing a sub-summary.
+     *  @throws             std::runtime_error if the window is invalid.
+     */
+    template <class... arg_types>
+    windowed(uint64_t window, size_t num_epochs, arg_types... args)
+        : m_current(0), m_epoch_size(0), m_epoch_updates(0)
+    {
+        if (num_epochs < 1 || window < num_epochs) {
+            throw std::runtime_error("the window must be no smaller than the number of epochs");
+        }
+        m_create = [=]() {
+            return new counter_type(args...);
+        };
+        m_epoch_size = (window + num_epochs - 1) / num_epochs;
+        for (size_t i = 0;i < num_epochs;++i) {
+            m_epochs.push_back(std::unique_ptr<counter_type>(m_create()));
+        }
+    }
+
+    virtual ~windowed()
+    {
+    }
+
+    /**
+     * Counts an occurrence of a key.
+     *  @param  key     The key.
+     *  @return bool    \c true if a counter was assigned to the key in the
+     *                  current epoch.
+     */
+    bool append(const key_view& key)
+    {
+        if (m_epoch_updates == m_epoch_size) {
+            slide();
+        }
+        ++m_epoch_updates;
+        return m_epochs[m_current]->append(key);
+    }
+
+    /**
+     * Visits the items in the window whose counts are no smaller than a
+     * threshold, in the descending order of their counts.
+     *  @param  threshold   The minimum count of items to visit.
+     *  @param  visit       The function receiving an item (const item_type&).
+     *  @return size_t      The number of visited items.
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        std::unique_ptr<counter_type> merged(m_create());
+        size_t n = m_epochs.size();
+        for (size_t i = 1;i <= n;++i) {
+            merged->merge(*m_epochs[(m_current + i) % n]);
+        }
+        return merged->items_above(threshold, visit);
+    }
+
+    void save(const std::string&) const
+    {
+        throw std::runtime_error("snapshots are not supported with --window");
+    }
+
+    void load(const std::string&)
+    {
+        throw std::runtime_error("snapshots are not supported with --window");
+    }
+
+    /**
+     * Gets the number of updates in the window.
+     */
+    count_type total() const
+    {
+        count_type n = 0;
+        for (size_t i = 0;i < m_epochs.size();++i) {
+            n += m_epochs[i]->total();
+        }
+        return n;
+    }
+
+    void write_stats(stats_writer& writer) const
+    {
+        writer.add("epochs", (uint64_t)m_epochs.size());
+        writer.add("epoch_size", m_epoch_size);
+        writer.begin("current_epoch");
+        write_counter_stats(writer, *m_epochs[m_current]);
+        writer.end();
+    }
+
+protected:
+    void slide()
+    {
+        m_current = (m_current + 1) % m_epochs.size();
+        m_epochs[m_current].reset(m_create());
+        m_epoch_updates = 0;
+    }
+};
+
+/**
+ * A summary of exponentially decayed counts.
+ *  An occurrence t updates ago counts as exp(-lambda t). This implements
+ *  forward decay: the n-th update adds the weight exp(lambda n) (relative
+ *  to a landmark) to the counter of Space-Saving, and a query divides the
+ *  counts by the weight of the latest update. Since the weights grow
+ *  exponentially, the counts are rescaled lazily, in O(m), when the weight
+ *  exceeds a limit, and the landmark moves to the latest update.
+ *  @param  key_tmpl        Key type.
+ */
+template <class key_tmpl>
+class decayed
+{
+public:
+    /// The summary of weighted counts.
+    typedef spacesaving_PriorityQ<key_tmpl, double> counter_type;
+    /// Key type.
+    typedef key_tmpl key_type;
+    /// Count type.
+    typedef double count_type;
+    /// The type for looking up a key.
+    typedef typename counter_type::key_view key_view;
+
+    /**
+     * A count item presenting the decayed count.
+     */
+    class item_type
+    {
+    protected:
+        const typename counter_type::item_type& m_item;
+        double m_scale;
+
+    public:
+        item_type(const typename counter_type::item_type& item, double scale)
+            : m_item(item), m_scale(scale)
+        {
+        }
+
+        const key_type& get_key() const
+        {
+            return m_item.get_key();
+        }
+
+        double get_count() const
+        {
+            return m_item.get_count() * m_scale;
+        }
+
+        double get_epsilon() const
+        {
+            return m_item.get_epsilon() * m_scale;
+        }
+    };
+
+protected:
+    /// The summary of weighted counts.
+    counter_type m_counter;
+    /// The growth of the weight per update, exp(lambda).
+    double m_growth;
+    /// The weight of the latest update.
+    double m_weight;
+    /// The weight triggering a rescale.
+    static constexpr double max_weight = 1e100;
+
+public:
+    /**
+     * Constructs an object.
+     *  @param  m       The maximum number of counters.
+     *  @param  lambda  The decay rate per update.
+     *  @throws         std::runtime_error if the decay rate is invalid.
+     */
+    decayed(int m, double lambda)
+        : m_counter(m), m_growth(std::exp(lambda)), m_weight(0.)
+    {
+        if (!(0. < lambda && lambda < 100.)) {
+            throw std::runtime_error("the decay rate must be in (0, 100)");
+        }
+        m_weight = 1. / m_growth;
+    }
+
+    virtual ~decayed()
+    {
+    }
+
+    /**
+     * Counts an occurrence of a key.
+     *  @param  key     The key.
+     *  @return bool    \c true if a counter was assigned to the key.
+     */
+    bool append(const key_view& key)
+    {
+        m_weight *= m_growth;
+        if (max_weight < m_weight) {
+            m_counter.scale(1. / m_weight);
+            m_weight = 1.;
+        }
+        return m_counter.append(key, m_weight);
+    }
+
+    /**
+     * Visits the items whose decayed counts are no smaller than a
+     * threshold, in the descending order of their counts.
+     *  @param  threshold   The minimum decayed count of items to visit.
+     *  @param  visit       The function receiving an item (const item_type&).
+     *  @return size_t      The number of visited items.
+     */
+    template <class visitor_type>
+    size_t items_above(double threshold, visitor_type visit) const
+    {
+        double scale = 1. / m_weight;
+        return m_counter.items_above(threshold * m_weight, [&](const typename counter_type::item_type& item) {
+            visit(item_type(item, scale));
+        });
+    }
+
+    void save(const std::string&) const
+    {
+        throw std::runtime_error("snapshots are not supported with --decay");
+    }
+
+    void load(const std::string&)
+    {
+        throw std::runtime_error("snapshots are not supported with --decay");
+    }
+
+    /**
+     * Gets the decayed number of updates.
+     */
+    double total() const
+    {
+        return m_counter.total() / m_weight;
+    }
+
+    void write_stats(stats_writer& writer) const
+    {
+        write_counter_stats(writer, m_counter);
+    }
+};
+
+#endif/*__WINDOWED_H__*/
@@ -0,0 +1,302 @@
+/*
+ *      Buffered output writer.
+ *
+ * Copyright (c) 2011 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the authors nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+
+#ifdef  _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif/*_WIN32*/
+
+/**
+ * A writer that formats text into a large buffer.
+ *  A writer attached to a file descriptor writes the buffer with a single
+ *  write(2) call whenever it fills up; a writer without a file descriptor
+ *  (fd = -1) grows the buffer and keeps the whole text in memory, e.g., for
+ *  formatting a part of the output in another thread. Numbers are formatted
+ *  without going through iostreams and locales.
+ */
+class output_writer
+{
+protected:
+    /// The file descriptor (-1 for writing to the memory).
+    int m_fd;
+    /// The buffer.
+    std::vector<char> m_buffer;
+    /// The number of bytes in the buffer.
+    size_t m_size;
+
+public:
+    /**
+     * Constructs a writer.
+     *  @param  fd          The file descriptor to write (-1 for the memory).
+     *  @param  buffer_size The size of the buffer.
+     */
+    output_writer(int fd = -1, size_t buffer_size = 1 << 20)
+        : m_fd(fd), m_buffer(std::max(buffer_size, (size_t)64)), m_size(0)
+    {
+    }
+
+    /**
+     * Destructs the writer.
+     *  The remaining text is written on a best-effort basis; call flush()
+     *  to detect write errors.
+     */
+    virtual ~output_writer()
+    {
+        try {
+            flush();
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+private:
+    output_writer(const output_writer&);
+    output_writer& operator=(const output_writer&);
+
+public:
+    /**
+     * Writes a character.
+     */
+    void put(char c)
+    {
+        *reserve(1) = c;
+        ++m_size;
+    }
+
+    /**
+     * Writes a string.
+     */
+    void put(std::string_view s)
+    {
+        if (m_buffer.size() - m_size < s.size() && 0 <= m_fd && m_buffer.size() <= s.size()) {
+            // Write a long string directly.
+            flush();
+            write_all(s.data(), s.size());
+            return;
+        }
+        std::memcpy(reserve(s.size()), s.data(), s.size());
+        m_size += s.size();
+    }
+
+    /**
+     * Writes a string.
+     */
+    void put(const std::string& s)
+    {
+        put(std::string_view(s));
+    }
+
+    /**
+     * Writes a number in decimal notation.
+     *  Floating-point numbers are formatted as "%g", which is the default
+     *  notation of iostreams.
+     */
+    template <class value_type>
+    typename std::enable_if<std::is_arithmetic<value_type>::value>::type
+    put(value_type value)
+    {
+        if constexpr (std::is_floating_point<value_type>::value) {
+            char *p = reserve(32);
+            m_size += std::snprintf(p, 32, "%g", (double)value);
+        } else if constexpr (std::is_signed<value_type>::value) {
+            if (value < 0) {
+                put('-');
+                put_unsigned((uint64_t)0 - (uint64_t)(int64_t)value);
+            } else {
+                put_unsigned((uint64_t)value);
+            }
+        } else {
+            put_unsigned((uint64_t)value);
+        }
+    }
+
+    /**
+     * Writes the text formatted by a memory writer.
+     */
+    void put(const output_writer& other)
+    {
+        put(std::string_view(other.data(), other.size()));
+    }
+
+    /**
+     * Gets the text in the buffer.
+     */
+    const char *data() const
+    {
+        return m_buffer.data();
+    }
+
+    /**
+     * Gets the number of bytes in the buffer.
+     */
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * Discards the text in the buffer.
+     */
+    void clear()
+    {
+        m_size = 0;
+    }
+
+    /**
+     * Writes the text in the buffer to the file descriptor.
+     *  @throws         std::runtime_error if writing failed.
+     */
+    void flush()
+    {
+        if (0 <= m_fd && 0 < m_size) {
+            size_t size = m_size;
+            m_size = 0;
+            write_all(m_buffer.data(), size);
+        }
+    }
+
+protected:
+    char *reserve(size_t n)
+    {
+        if (m_buffer.size() - m_size < n) {
+            flush();
+            if (m_buffer.size() - m_size < n) {
+                m_buffer.resize(std::max(m_buffer.size() * 2, m_size + n));
+            }
+        }
+        return &m_buffer[m_size];
+    }
+
+    void put_unsigned(uint64_t value)
+    {
+        static const char digits[] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+        // Format the digits backwards, two at a time.
+        char tmp[20];
+        char *q = tmp + sizeof(tmp);
+        while (100 <= value) {
+            unsigned i = (unsigned)(value % 100) * 2;
+            value /= 100;
+            *--q = digits[i+1];
+            *--q = digits[i];
+        }
+        if (10 <= value) {
+            unsigned i = (unsigned)value * 2;
+            *--q = digits[i+1];
+            *--q = digits[i];
+        } else {
+            *--q = (char)('0' + value);
+        }
+        size_t n = tmp + sizeof(tmp) - q;
+        std::memcpy(reserve(n), q, n);
+        m_size += n;
+    }
+
+    void write_all(const char *p, size_t size)
+    {
+        while (0 < size) {
+#ifdef  _WIN32
+            int ret = ::_write(m_fd, p, (unsigned int)std::min(size, (size_t)1 << 30));
+#else
+            ssize_t ret = ::write(m_fd, p, size);
+#endif/*_WIN32*/
+            if (0 <= ret) {
+                p += ret;
+                size -= (size_t)ret;
+            } else if (errno != EINTR) {
+                throw std::runtime_error("failed to write the output");
+            }
+        }
+    }
+};
+
+/**
+ * Formats a sequence of records with multiple threads.
+ *  The records are split into rounds of consecutive ranges, one range per
+ *  thread; every thread formats its range into its own memory writer, and
+ *  the texts are written in the order of the records. Thus, the output is
+ *  identical to that of a single thread.
+ *  @param  writer      The writer.
+ *  @param  n           The number of records.
+ *  @param  num_threads The number of threads.
+ *  @param  format      The function receiving a writer and a record number.
+ */
+template <class format_type>
+void write_parallel(output_writer& writer, size_t n, int num_threads, format_type format)
+{
+    if (num_threads <= 1 || n == 0) {
+        for (size_t i = 0;i < n;++i) {
+            format(writer, i);
+        }
+        return;
+    }
+
+    const size_t range = 1 << 16;
+    std::vector<output_writer> outputs(num_threads);
+    for (size_t first = 0;first < n;first += range * num_threads) {
+        std::vector<std::thread> threads;
+        for (int t = 0;t < num_threads;++t) {
+            size_t begin = std::min(first + range * t, n);
+            size_t end = std::min(begin + range, n);
+            threads.push_back(std::thread([&outputs, &format, t, begin, end]() {
+                outputs[t].clear();
+                for (size_t i = begin;i < end;++i) {
+                    format(outputs[t], i);
+                }
+            }));
+        }
+        for (int t = 0;t < num_threads;++t) {
+            threads[t].join();
+            writer.put(outputs[t]);
+        }
+    }
+}
+
+#endif/*__WRITER_H__*/